@@ -11,12 +11,75 @@ import os
 import os.path
 import sys
 import enum
+import gzip
+import shutil
+import struct
 
 import orcus
 from orcus.tools.file_processor import config
 
 
 FORMULAS_FILENAME_XML = f"{config.prefix_skip}formulas.xml"
+FORMULAS_FILENAME_BIN = f"{config.prefix_skip}formulas.bin"
+
+# Set this environment variable to 'bin' to write the formula data in the
+# binary corpus format instead of XML.
+FORMAT_ENV_NAME = "ORCUS_ML_FORMULA_FORMAT"
+
+# Set this environment variable to 'gzip' or 'zstd' to write the formula data
+# compressed.  The file names then get the '.gz' or '.zst' extension.
+COMPRESS_ENV_NAME = "ORCUS_ML_FORMULA_COMPRESS"
+
+COMPRESS_EXTENSIONS = {
+    "gzip": ".gz",
+    "zstd": ".zst",
+}
+
+# Must match the values of ixion::fopcode_t.
+OPCODE_VALUES = {
+    "unknown": 0,
+    "single-ref": 1,
+    "range-ref": 2,
+    "table-ref": 3,
+    "named-expression": 4,
+    "string": 5,
+    "value": 6,
+    "function": 7,
+    "plus": 8,
+    "minus": 9,
+    "divide": 10,
+    "multiply": 11,
+    "exponent": 12,
+    "concat": 13,
+    "equal": 14,
+    "not-equal": 15,
+    "less": 16,
+    "greater": 17,
+    "less-equal": 18,
+    "greater-equal": 19,
+    "open": 20,
+    "close": 21,
+    "sep": 22,
+    "error": 23,
+}
+
+
+def open_output(path, mode, compress=None):
+    """Open a file for writing, compressed with the specified method if any.
+
+    :return: tuple of the file object and the actual path of the file.
+    """
+    if not compress:
+        return open(path, mode), path
+
+    path += COMPRESS_EXTENSIONS[compress]
+
+    if compress == "gzip":
+        return gzip.open(path, mode), path
+
+    # Not in the standard library.
+    import zstandard
+    return zstandard.open(path, mode), path
 
 
 def to_string(obj):
@@ -44,7 +107,118 @@ def escape_str(s):
     return "".join(buf)
 
 
+class BinaryCorpusWriter:
+    """Writes formula data in the binary corpus format.
+
+    See src/formula_corpus.hpp for the description of the format.
+    """
+
+    MAGIC = b"OMLFCORP"
+    VERSION = 1
+
+    REC_DOC = 1
+    REC_FUNCTION = 2
+    REC_SHEET = 3
+    REC_NAMED_EXPRESSION = 4
+    REC_FORMULA = 5
+    REC_DOC_END = 6
+
+    def __init__(self, f):
+        self._f = f
+        self._functions = dict()
+        f.write(self.MAGIC)
+        f.write(struct.pack("<I", self.VERSION))
+
+    @staticmethod
+    def _str(s):
+        b = s.encode("utf-8")
+        return struct.pack("<I", len(b)) + b
+
+    def _record(self, rtype, payload):
+        self._f.write(struct.pack("<BI", rtype, len(payload)))
+        self._f.write(payload)
+
+    def _function_pos(self, name):
+        pos = self._functions.get(name)
+        if pos is None:
+            pos = len(self._functions)
+            self._functions[name] = pos
+            self._record(self.REC_FUNCTION, self._str(name))
+        return pos
+
+    def _tokens(self, tokens):
+        buf = [struct.pack("<I", len(tokens))]
+        for token in tokens:
+            op = OPCODE_VALUES[to_string(token.op)]
+            buf.append(struct.pack("<B", op))
+            if op == OPCODE_VALUES["function"]:
+                buf.append(struct.pack("<H", self._function_pos(str(token))))
+            elif op == OPCODE_VALUES["named-expression"]:
+                buf.append(self._str(str(token)))
+        return b"".join(buf)
+
+    def start_doc(self, filepath):
+        self._functions = dict()
+        self._record(self.REC_DOC, self._str(filepath))
+
+    def end_doc(self):
+        self._record(self.REC_DOC_END, b"")
+
+    def sheet(self, name):
+        self._record(self.REC_SHEET, self._str(name))
+
+    def named_expression(self, name, sheet_name=None):
+        scope = 0 if sheet_name is None else 1
+        payload = struct.pack("<B", scope) + self._str(name) + self._str(sheet_name or "")
+        self._record(self.REC_NAMED_EXPRESSION, payload)
+
+    def formula(self, sheet_name, row, column, formula, tokens, valid):
+        # Function records referenced by the tokens must come first.
+        tokens_payload = self._tokens(tokens) if valid else struct.pack("<I", 0)
+        payload = b"".join((
+            self._str(sheet_name),
+            struct.pack("<IIB", row, column, 1 if valid else 0),
+            self._str(formula),
+            tokens_payload,
+        ))
+        self._record(self.REC_FORMULA, payload)
+
+
+def process_document_bin(filepath, doc):
+    outpath = f"{filepath}{FORMULAS_FILENAME_BIN}"
+    f, outpath = open_output(outpath, "wb", os.environ.get(COMPRESS_ENV_NAME))
+    with f:
+        writer = BinaryCorpusWriter(f)
+        writer.start_doc(filepath)
+
+        for sheet in doc.sheets:
+            writer.sheet(sheet.name)
+
+        for name, exp in doc.get_named_expressions():
+            writer.named_expression(name)
+        for sheet in doc.sheets:
+            for name, exp in sheet.get_named_expressions():
+                writer.named_expression(name, sheet.name)
+
+        for sheet in doc.sheets:
+            for row_pos, row in enumerate(sheet.get_rows()):
+                for col_pos, cell in enumerate(row):
+                    if cell.type == orcus.CellType.FORMULA:
+                        tokens = list(cell.get_formula_tokens())
+                        writer.formula(sheet.name, row_pos, col_pos, cell.formula, tokens, True)
+                    elif cell.type == orcus.CellType.FORMULA_WITH_ERROR:
+                        tokens = [str(t) for t in cell.get_formula_tokens()]
+                        writer.formula(sheet.name, row_pos, col_pos, tokens[1], [], False)
+
+        writer.end_doc()
+
+    return list()
+
+
 def process_document(filepath, doc):
+    if os.environ.get(FORMAT_ENV_NAME) == "bin":
+        return process_document_bin(filepath, doc)
+
 
     def write_tokens(iter, f):
         for token in iter:
@@ -63,7 +237,8 @@ def process_document(filepath, doc):
             f.write("</named-expression>")
 
     outpath = f"{filepath}{FORMULAS_FILENAME_XML}"
-    with open(outpath, "w") as f:
+    f, outpath = open_output(outpath, "wt", os.environ.get(COMPRESS_ENV_NAME))
+    with f:
         output_buffer = list()
         f.write(f'<doc filepath="{escape_str(filepath)}"><sheets count="{len(doc.sheets)}">')
         for sheet in doc.sheets:
@@ -103,22 +278,43 @@ def main():
     import argparse
     parser = argparse.ArgumentParser()
     parser.add_argument("-o", "--output", type=str, required=True, help="Output directory to write all the formula data to.")
+    parser.add_argument(
+        "--format", type=str, choices=("xml", "bin"), default="xml",
+        help="Format of the formula data files to collect.")
+    parser.add_argument(
+        "--compress", type=str, choices=tuple(COMPRESS_EXTENSIONS.keys()),
+        help="Compress the collected files that are not compressed yet with the specified method.")
     parser.add_argument("rootdir", help="Root directory from which to traverse for the formula files.")
     args = parser.parse_args()
 
     os.makedirs(args.output, exist_ok=True)
 
+    suffix = FORMULAS_FILENAME_BIN if args.format == "bin" else FORMULAS_FILENAME_XML
+
     i = 0
     for root, dir, files in os.walk(args.rootdir):
         for filename in files:
-            if not filename.endswith(FORMULAS_FILENAME_XML):
+            # The files may have been written compressed.
+            ext = ""
+            for e in COMPRESS_EXTENSIONS.values():
+                if filename.endswith(suffix + e):
+                    ext = e
+
+            if not ext and not filename.endswith(suffix):
                 continue
 
             inpath = os.path.join(root, filename)
-            outpath = os.path.join(args.output, f"{i+1:04}.xml")
-            os.link(inpath, outpath)
+            outpath = os.path.join(args.output, f"{i+1:04}.{args.format}")
             i += 1
 
+            if ext or not args.compress:
+                os.link(inpath, f"{outpath}{ext}")
+                continue
+
+            f, outpath = open_output(outpath, "wb", args.compress)
+            with open(inpath, "rb") as src, f:
+                shutil.copyfileobj(src, f)
+
 
 if __name__ == "__main__":
     main()
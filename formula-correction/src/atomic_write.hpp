@@ -0,0 +1,65 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+/** Number of the next temporary file, unique within the process. */
+inline std::atomic<uint64_t> next_tmp_file{0};
+
+/**
+ * Write a file through a temporary file in the same directory, which
+ * replaces the file only once it is completely written.  A reader never
+ * sees a partially written file, and an interrupted run leaves the previous
+ * file in place.  Each call writes its own temporary file, so that threads
+ * writing the same file concurrently do not interfere, and the last one to
+ * finish replaces the file.
+ *
+ * @param path path of the file to write.
+ * @param func function to call with the output stream to write the content
+ *             to.
+ *
+ * @throw std::runtime_error if the file cannot be opened or written.
+ */
+template<typename FuncT>
+void write_atomically(const boost::filesystem::path& path, FuncT func)
+{
+    namespace fs = boost::filesystem;
+
+    fs::path tmp_path = path;
+    tmp_path += ".tmp" + std::to_string(next_tmp_file++);
+
+    try
+    {
+        std::ofstream of(tmp_path.string(), std::ios::binary);
+        if (!of)
+            throw std::runtime_error("failed to open " + tmp_path.string());
+
+        func(of);
+        of.close();
+
+        if (!of)
+            throw std::runtime_error("failed to write " + path.string());
+
+        fs::rename(tmp_path, path);
+    }
+    catch (...)
+    {
+        boost::system::error_code ec;
+        fs::remove(tmp_path, ec);
+        throw;
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
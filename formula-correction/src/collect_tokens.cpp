@@ -5,6 +5,8 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#include "file_scheduler.hpp"
+
 #include <orcus/sax_ns_parser.hpp>
 #include <orcus/stream.hpp>
 #include <orcus/types.hpp>
@@ -12,8 +14,16 @@
 #include <orcus/xml_namespace.hpp>
 #include <boost/program_options.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <future>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace po = boost::program_options;
@@ -21,18 +31,40 @@ using std::cout;
 using std::cerr;
 using std::endl;
 
+/**
+ * Occurrence counts of the element and attribute names seen by one thread.
+ * The keys point into the string pool of the same thread.
+ */
+struct name_counts
+{
+    using map_type = std::unordered_map<orcus::pstring, size_t, orcus::pstring::hash>;
+
+    orcus::string_pool pool;
+    map_type elements;
+    map_type attributes;
+
+    void add(map_type& counts, const orcus::pstring& name)
+    {
+        auto it = counts.find(name);
+        if (it == counts.end())
+            counts.emplace(pool.intern(name).first, 1);
+        else
+            ++it->second;
+    }
+};
+
 class xml_handler : public orcus::sax_ns_handler
 {
-    orcus::string_pool& m_shared_pool;
+    name_counts& m_counts;
     std::vector<orcus::xml_name_t> m_stack;
 
 public:
-    xml_handler(orcus::string_pool& pool) : m_shared_pool(pool) {}
+    xml_handler(name_counts& counts) : m_counts(counts) {}
 
     void start_element(const orcus::sax_ns_parser_element& elem)
     {
         m_stack.emplace_back(elem.ns, elem.name);
-        m_shared_pool.intern(elem.name);
+        m_counts.add(m_counts.elements, elem.name);
     }
 
     void end_element(const orcus::sax_ns_parser_element& elem)
@@ -48,42 +80,131 @@ public:
 
     void attribute(const orcus::sax_ns_parser_attribute& attr)
     {
-        m_shared_pool.intern(attr.name);
+        m_counts.add(m_counts.attributes, attr.name);
     }
 };
 
+/**
+ * Collects the element and attribute names of the input files on multiple
+ * threads.  Each thread counts into its own pool and maps, which get merged
+ * once all files are parsed.
+ */
 class token_collector
 {
-    orcus::string_pool m_pool;
-    const size_t m_file_count;
-    size_t m_counter = 0;
+    using count_map_type = std::map<std::string, size_t>;
 
-public:
-    token_collector(size_t file_count) : m_file_count(file_count) {}
+    const std::vector<std::string>& m_filepaths;
+    std::atomic<size_t> m_counter{0};
+    count_map_type m_elements;
+    count_map_type m_attributes;
 
-    void parse_file(const std::string& filepath)
+    void parse_file(const std::string& filepath, name_counts& counts)
     {
         orcus::file_content content(filepath.data());
-        cout << "[" << ++m_counter << "/" << m_file_count << "] filepath: " << filepath << " (size: " << content.size() << ")" << endl;
+
+        std::ostringstream os;
+        os << "[" << ++m_counter << "/" << m_filepaths.size() << "] filepath: " << filepath
+            << " (size: " << content.size() << ")" << endl;
+        cout << os.str();
+
         orcus::xmlns_repository repo;
         auto cxt = repo.create_context();
-        xml_handler hdl(m_pool);
+        xml_handler hdl(counts);
         orcus::sax_ns_parser<xml_handler> parser(content.data(), content.size(), cxt, hdl);
         parser.parse();
     }
 
+    void run_worker(file_scheduler& scheduler, size_t worker, name_counts& counts)
+    {
+        bool stolen = false;
+        for (const std::string* filepath = scheduler.next(worker, stolen); filepath;
+             filepath = scheduler.next(worker, stolen))
+            parse_file(*filepath, counts);
+    }
+
+    static void merge(count_map_type& dest, const name_counts::map_type& src)
+    {
+        for (const auto& entry : src)
+            dest[entry.first.str()] += entry.second;
+    }
+
+    static void write_counts(std::ostream& os, const char* kind, const count_map_type& counts)
+    {
+        std::vector<std::pair<std::string, size_t>> sorted(counts.begin(), counts.end());
+
+        // Most frequent first, ties by name.
+        std::stable_sort(sorted.begin(), sorted.end(),
+            [](const auto& l, const auto& r) { return l.second > r.second; });
+
+        for (const auto& entry : sorted)
+            os << entry.second << '\t' << kind << '\t' << entry.first << '\n';
+    }
+
+public:
+    token_collector(const std::vector<std::string>& filepaths) : m_filepaths(filepaths) {}
+
+    void parse_files(size_t thread_count)
+    {
+        file_scheduler scheduler(m_filepaths, thread_count);
+        std::vector<name_counts> counts(thread_count);
+        std::vector<std::future<void>> futures;
+
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            futures.push_back(std::async(
+                std::launch::async, &token_collector::run_worker, this,
+                std::ref(scheduler), i, std::ref(counts[i])));
+        }
+
+        for (auto& future : futures)
+            future.get();
+
+        for (const name_counts& c : counts)
+        {
+            merge(m_elements, c.elements);
+            merge(m_attributes, c.attributes);
+        }
+    }
+
+    /**
+     * Write the unique element and attribute names in ascending order, one
+     * per line.
+     */
     void write_tokens(std::ostream& os)
     {
-        for (const auto& token : m_pool.get_interned_strings())
-            os << token << endl;
+        std::set<std::string> names;
+        for (const auto& entry : m_elements)
+            names.insert(entry.first);
+        for (const auto& entry : m_attributes)
+            names.insert(entry.first);
+
+        for (const std::string& name : names)
+            os << name << '\n';
+    }
+
+    /**
+     * Write the occurrence counts of the element names, then of the
+     * attribute names, each in descending order of their counts.  Each line
+     * consists of the count, the kind of name and the name, separated by
+     * tabs.
+     */
+    void write_counts(std::ostream& os)
+    {
+        write_counts(os, "element", m_elements);
+        write_counts(os, "attribute", m_attributes);
     }
 };
 
 int main(int argc, char** argv)
 {
+    size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    bool counts = false;
+
     po::options_description desc("Allowed options");
     desc.add_options()
         ("help,h", "Print this help.")
+        ("threads,j", po::value<size_t>(&thread_count), "Number of threads to parse the input files with.  The default is the number of hardware threads.")
+        ("counts", po::bool_switch(&counts), "Write the occurrence counts of the element and attribute names, most frequent first, instead of the unique names.")
         ("output,o", po::value<std::string>(), "Output file to write tokens to.");
 
     po::options_description hidden("Hidden options");
@@ -122,9 +243,17 @@ int main(int argc, char** argv)
 
     std::vector<std::string> input_files = vm["input-files"].as<std::vector<std::string>>();
 
-    token_collector collector(input_files.size());
-    for (const std::string& filepath : input_files)
-        collector.parse_file(filepath);
+    token_collector collector(input_files);
+
+    try
+    {
+        collector.parse_files(std::max<size_t>(1, thread_count));
+    }
+    catch (const std::exception& e)
+    {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
 
     std::ostream* os = &cout; // write to stdout by default.
     std::ofstream of;
@@ -136,7 +265,10 @@ int main(int argc, char** argv)
         os = &of;
     }
 
-    collector.write_tokens(*os);
+    if (counts)
+        collector.write_counts(*os);
+    else
+        collector.write_tokens(*os);
     return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,207 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "debug_trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace debug_trace_format {
+
+bool has_magic(const char* p, size_t n)
+{
+    return n >= sizeof(magic) && !std::memcmp(p, magic, sizeof(magic));
+}
+
+} // namespace debug_trace_format
+
+namespace {
+
+size_t round_up_pow2(size_t n)
+{
+    size_t v = 1;
+    while (v < n)
+        v <<= 1;
+    return v;
+}
+
+void append_u32(std::string& buf, uint32_t v)
+{
+    const char bytes[4] = { char(v), char(v >> 8), char(v >> 16), char(v >> 24) };
+    buf.append(bytes, 4);
+}
+
+} // anonymous namespace
+
+spsc_ring::spsc_ring(size_t capacity) :
+    m_buffer(new char[round_up_pow2(std::max<size_t>(capacity, 64))]),
+    m_mask(round_up_pow2(std::max<size_t>(capacity, 64)) - 1) {}
+
+void spsc_ring::write(const char* p, size_t n)
+{
+    size_t head = m_head.load(std::memory_order_relaxed);
+    const size_t capacity = m_mask + 1;
+
+    while (n)
+    {
+        size_t free_bytes = capacity - (head - m_tail.load(std::memory_order_acquire));
+        if (!free_bytes)
+        {
+            // Wait for the consumer.
+            std::this_thread::yield();
+            continue;
+        }
+
+        size_t pos = head & m_mask;
+        size_t len = std::min({n, free_bytes, capacity - pos});
+        std::memcpy(m_buffer.get() + pos, p, len);
+
+        head += len;
+        p += len;
+        n -= len;
+        m_head.store(head, std::memory_order_release);
+    }
+}
+
+debug_trace_channel::debug_trace_channel(size_t ring_size) : m_ring(ring_size) {}
+
+spsc_ring& debug_trace_channel::ring()
+{
+    return m_ring;
+}
+
+void debug_trace_channel::begin(debug_trace_format::record_type type)
+{
+    m_record.clear();
+    m_record.push_back(char(type));
+    append_u32(m_record, 0); // payload length, set in commit().
+}
+
+void debug_trace_channel::put_u32(uint32_t v)
+{
+    append_u32(m_record, v);
+}
+
+void debug_trace_channel::put_str(const orcus::pstring& s)
+{
+    append_u32(m_record, s.size());
+    m_record.append(s.data(), s.size());
+}
+
+void debug_trace_channel::commit()
+{
+    uint32_t len = m_record.size() - 5;
+    for (size_t i = 0; i < 4; ++i)
+        m_record[1+i] = char(len >> (8 * i));
+
+    m_ring.write(m_record.data(), m_record.size());
+}
+
+void debug_trace_channel::doc(const orcus::pstring& filepath)
+{
+    begin(debug_trace_format::rec_doc);
+    put_str(filepath);
+    commit();
+}
+
+void debug_trace_channel::formula(
+    const orcus::pstring& sheet, const orcus::pstring& row, const orcus::pstring& column,
+    const orcus::pstring& formula)
+{
+    begin(debug_trace_format::rec_formula);
+    put_str(sheet);
+    put_str(row);
+    put_str(column);
+    put_str(formula);
+    commit();
+}
+
+void debug_trace_channel::tokens(const uint16_t* p, size_t n)
+{
+    begin(debug_trace_format::rec_tokens);
+    put_u32(n);
+    for (const uint16_t* end = p + n; p != end; ++p)
+    {
+        m_record.push_back(char(*p));
+        m_record.push_back(char(*p >> 8));
+    }
+    commit();
+}
+
+debug_trace_writer::debug_trace_writer(size_t ring_size) :
+    m_ring_size(ring_size),
+    m_thread(&debug_trace_writer::run, this) {}
+
+debug_trace_writer::~debug_trace_writer()
+{
+    stop();
+}
+
+void debug_trace_writer::run()
+{
+    while (!m_stop.load(std::memory_order_acquire))
+    {
+        if (!drain())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // The producers are done by now.
+    drain();
+}
+
+bool debug_trace_writer::drain()
+{
+    std::vector<sink*> sinks;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        for (auto& s : m_sinks)
+            sinks.push_back(s.get());
+    }
+
+    size_t written = 0;
+    for (sink* s : sinks)
+    {
+        written += s->channel.ring().drain(
+            [s](const char* p, size_t n) { s->os.write(p, n); });
+    }
+
+    return written > 0;
+}
+
+debug_trace_channel& debug_trace_writer::open_channel(const std::string& filepath)
+{
+    auto s = std::make_unique<sink>(m_ring_size);
+    s->os.open(filepath, std::ios::binary);
+    if (!s->os)
+        throw std::runtime_error("failed to open " + filepath);
+
+    s->os.write(debug_trace_format::magic, sizeof(debug_trace_format::magic));
+    std::string version;
+    append_u32(version, debug_trace_format::version);
+    s->os.write(version.data(), version.size());
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_sinks.push_back(std::move(s));
+    return m_sinks.back()->channel;
+}
+
+void debug_trace_writer::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    m_stop.store(true, std::memory_order_release);
+    m_thread.join();
+
+    std::lock_guard<std::mutex> lock(m_mtx);
+    for (auto& s : m_sinks)
+        s->os.flush();
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
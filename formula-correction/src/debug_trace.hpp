@@ -0,0 +1,184 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <orcus/pstring.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Binary debug trace written by formula-data-parser with --debug, and
+ * rendered to text by formula-trace-render.  A file starts with an 8-byte
+ * magic and a 4-byte version, followed by a sequence of records, each
+ * consisting of a 1-byte record type, a 4-byte payload length and the
+ * payload.  All integers are unsigned and little-endian, and each string
+ * is stored as a 4-byte length followed by its bytes.
+ *
+ * Record payloads:
+ *
+ * - doc: filepath (string).
+ * - formula: sheet name, row, column and formula (all strings).
+ * - tokens: token count (4 bytes), encoded tokens (2 bytes each).  Follows
+ *   the formula record of an accepted formula.
+ */
+namespace debug_trace_format {
+
+constexpr char magic[8] = { 'O', 'M', 'L', 'F', 'T', 'R', 'A', 'C' };
+constexpr uint32_t version = 1;
+
+enum record_type : uint8_t
+{
+    rec_doc     = 1,
+    rec_formula = 2,
+    rec_tokens  = 3,
+};
+
+bool has_magic(const char* p, size_t n);
+
+} // namespace debug_trace_format
+
+/**
+ * Byte queue over a fixed-size ring buffer, for exactly one producer thread
+ * and one consumer thread.  Neither side takes a lock.  The producer waits
+ * for the consumer when the ring is full.
+ */
+class spsc_ring
+{
+    std::unique_ptr<char[]> m_buffer;
+    const size_t m_mask;
+
+    // Total numbers of bytes written and read.  Kept on separate cache
+    // lines so that the two sides do not contend.
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+
+public:
+    /**
+     * @param capacity size of the ring in bytes.  It is rounded up to a
+     *                 power of two.
+     */
+    explicit spsc_ring(size_t capacity);
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator= (const spsc_ring&) = delete;
+
+    /**
+     * Append bytes.  Call this on the producer thread only.
+     */
+    void write(const char* p, size_t n);
+
+    /**
+     * Pass all readable bytes to a function in up to two contiguous spans,
+     * and release them.  Call this on the consumer thread only.
+     *
+     * @return number of bytes passed.
+     */
+    template<typename FuncT>
+    size_t drain(FuncT func)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        size_t n = head - tail;
+        if (!n)
+            return 0;
+
+        size_t pos = tail & m_mask;
+        size_t first = std::min(n, m_mask + 1 - pos);
+        func(m_buffer.get() + pos, first);
+        if (first < n)
+            func(m_buffer.get(), n - first);
+
+        m_tail.store(head, std::memory_order_release);
+        return n;
+    }
+};
+
+/**
+ * Producer side of the debug trace of one worker thread.  The records are
+ * encoded in binary form into a ring buffer, and formatted only later by
+ * formula-trace-render.
+ */
+class debug_trace_channel
+{
+    spsc_ring m_ring;
+    std::string m_record; // record being encoded.
+
+    void begin(debug_trace_format::record_type type);
+    void put_u32(uint32_t v);
+    void put_str(const orcus::pstring& s);
+    void commit();
+
+public:
+    explicit debug_trace_channel(size_t ring_size);
+
+    spsc_ring& ring();
+
+    void doc(const orcus::pstring& filepath);
+
+    void formula(
+        const orcus::pstring& sheet, const orcus::pstring& row, const orcus::pstring& column,
+        const orcus::pstring& formula);
+
+    void tokens(const uint16_t* p, size_t n);
+};
+
+/**
+ * Drains the debug trace channels into their files on a background thread.
+ */
+class debug_trace_writer
+{
+    struct sink
+    {
+        debug_trace_channel channel;
+        std::ofstream os;
+
+        sink(size_t ring_size) : channel(ring_size) {}
+    };
+
+    const size_t m_ring_size;
+    std::mutex m_mtx;
+    std::vector<std::unique_ptr<sink>> m_sinks;
+    std::atomic<bool> m_stop{false};
+    std::thread m_thread;
+
+    void run();
+
+    /**
+     * @return true if any bytes were written.
+     */
+    bool drain();
+
+public:
+    explicit debug_trace_writer(size_t ring_size = 1 << 20);
+    ~debug_trace_writer();
+
+    debug_trace_writer(const debug_trace_writer&) = delete;
+    debug_trace_writer& operator= (const debug_trace_writer&) = delete;
+
+    /**
+     * Create a channel for one producer thread, writing to the specified
+     * file.  The channel stays valid for the lifetime of the writer.
+     */
+    debug_trace_channel& open_channel(const std::string& filepath);
+
+    /**
+     * Write out what remains in the channels and stop the background
+     * thread.  No records may be added after this call.
+     */
+    void stop();
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
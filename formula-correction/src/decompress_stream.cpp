@@ -0,0 +1,237 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "decompress_stream.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+constexpr size_t chunk_size = 1 << 16;
+
+// zlib counts the input in 32-bit units.
+constexpr size_t max_input_size = 1u << 30;
+
+} // anonymous namespace
+
+struct decompress_stream::impl
+{
+    format_type format;
+
+    const char* in_pos;
+    const char* in_end;
+
+    std::vector<char> chunk;
+    size_t chunk_pos = 0;
+    size_t chunk_end = 0;
+
+    bool eof = false;
+    bool frame_done = true; // whether the last frame or member is complete.
+
+    z_stream zs;
+
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx* dctx = nullptr;
+#endif
+
+    impl(const char* p, size_t n) :
+        format(detect(p, n)), in_pos(p), in_end(p + n), chunk(chunk_size)
+    {
+        switch (format)
+        {
+            case gzip:
+            {
+                std::memset(&zs, 0, sizeof(zs));
+
+                // Accept the gzip header only.
+                if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+                    throw std::runtime_error("gzip: failed to initialize the decompressor.");
+                break;
+            }
+            case zstd:
+            {
+#ifdef HAVE_ZSTD
+                dctx = ZSTD_createDCtx();
+                if (!dctx)
+                    throw std::runtime_error("zstd: failed to initialize the decompressor.");
+                break;
+#else
+                throw std::runtime_error("zstd compressed input is not supported by this build.");
+#endif
+            }
+            case none:
+                throw std::runtime_error("data is not compressed in a supported format.");
+        }
+    }
+
+    ~impl()
+    {
+        if (format == gzip)
+            inflateEnd(&zs);
+
+#ifdef HAVE_ZSTD
+        if (dctx)
+            ZSTD_freeDCtx(dctx);
+#endif
+    }
+
+    void fill_gzip()
+    {
+        zs.next_out = reinterpret_cast<Bytef*>(chunk.data());
+        zs.avail_out = chunk.size();
+
+        while (zs.avail_out == chunk.size())
+        {
+            if (!zs.avail_in)
+            {
+                if (in_pos == in_end)
+                {
+                    if (!frame_done)
+                        throw std::runtime_error("gzip: unexpected end of data.");
+
+                    eof = true;
+                    break;
+                }
+
+                size_t len = std::min<size_t>(in_end - in_pos, max_input_size);
+                zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in_pos));
+                zs.avail_in = len;
+                in_pos += len;
+            }
+
+            if (frame_done)
+            {
+                // Start of the next member of concatenated gzip data.
+                if (inflateReset(&zs) != Z_OK)
+                    throw std::runtime_error("gzip: failed to reset the decompressor.");
+                frame_done = false;
+            }
+
+            int ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END)
+                frame_done = true;
+            else if (ret != Z_OK)
+                throw std::runtime_error("gzip: corrupt data.");
+        }
+
+        chunk_pos = 0;
+        chunk_end = chunk.size() - zs.avail_out;
+    }
+
+#ifdef HAVE_ZSTD
+    void fill_zstd()
+    {
+        ZSTD_outBuffer out{chunk.data(), chunk.size(), 0};
+
+        while (!out.pos)
+        {
+            if (in_pos == in_end)
+            {
+                if (!frame_done)
+                    throw std::runtime_error("zstd: unexpected end of data.");
+
+                eof = true;
+                break;
+            }
+
+            ZSTD_inBuffer in{in_pos, size_t(in_end - in_pos), 0};
+            size_t ret = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(ret))
+                throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(ret));
+
+            in_pos += in.pos;
+            frame_done = ret == 0;
+        }
+
+        chunk_pos = 0;
+        chunk_end = out.pos;
+    }
+#endif
+
+    void fill()
+    {
+        if (format == gzip)
+            fill_gzip();
+#ifdef HAVE_ZSTD
+        else
+            fill_zstd();
+#endif
+    }
+};
+
+decompress_stream::format_type decompress_stream::detect(const char* p, size_t n)
+{
+    const auto* u = reinterpret_cast<const unsigned char*>(p);
+
+    if (n >= 2 && u[0] == 0x1F && u[1] == 0x8B)
+        return gzip;
+
+    if (n >= 4 && u[0] == 0x28 && u[1] == 0xB5 && u[2] == 0x2F && u[3] == 0xFD)
+        return zstd;
+
+    return none;
+}
+
+decompress_stream::decompress_stream(const char* p, size_t n) :
+    m_impl(std::make_unique<impl>(p, n)) {}
+
+decompress_stream::~decompress_stream() {}
+
+size_t decompress_stream::read(char* buf, size_t n)
+{
+    impl& im = *m_impl;
+    size_t read_size = 0;
+
+    while (read_size < n)
+    {
+        if (im.chunk_pos == im.chunk_end)
+        {
+            if (im.eof)
+                break;
+
+            im.fill();
+            continue;
+        }
+
+        size_t len = std::min(n - read_size, im.chunk_end - im.chunk_pos);
+        std::memcpy(buf + read_size, im.chunk.data() + im.chunk_pos, len);
+        im.chunk_pos += len;
+        read_size += len;
+    }
+
+    return read_size;
+}
+
+std::string decompress_stream::read_all()
+{
+    impl& im = *m_impl;
+    std::string content;
+
+    while (true)
+    {
+        content.append(im.chunk.data() + im.chunk_pos, im.chunk_end - im.chunk_pos);
+        im.chunk_pos = im.chunk_end;
+
+        if (im.eof)
+            break;
+
+        im.fill();
+    }
+
+    return content;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
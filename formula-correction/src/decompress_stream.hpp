@@ -0,0 +1,63 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+/**
+ * Decompresses gzip or zstd data held in memory, a chunk at a time, so that
+ * only a small window of the decompressed data is ever held at once.  The
+ * zstd support requires building with HAVE_ZSTD.
+ */
+class decompress_stream
+{
+public:
+    enum format_type { none, gzip, zstd };
+
+private:
+    struct impl;
+    std::unique_ptr<impl> m_impl;
+
+public:
+    /**
+     * Tell the compression format from the magic bytes of the data.
+     */
+    static format_type detect(const char* p, size_t n);
+
+    /**
+     * @param p compressed data.  It must outlive the stream.
+     * @param n size of the compressed data.
+     *
+     * @throw std::runtime_error if the data is not in a supported
+     *        compression format.
+     */
+    decompress_stream(const char* p, size_t n);
+    ~decompress_stream();
+
+    decompress_stream(const decompress_stream&) = delete;
+    decompress_stream& operator= (const decompress_stream&) = delete;
+
+    /**
+     * Read decompressed bytes.
+     *
+     * @return number of bytes read, which is less than requested only at
+     *         the end of the data.
+     *
+     * @throw std::runtime_error if the data is corrupt.
+     */
+    size_t read(char* buf, size_t n);
+
+    /**
+     * Read all remaining decompressed bytes.
+     */
+    std::string read_all();
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
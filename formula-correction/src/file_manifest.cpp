@@ -0,0 +1,131 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "file_manifest.hpp"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+/**
+ * Compute a 64-bit FNV-1a hash of the file content.
+ */
+std::string hash_file(const std::string& filepath)
+{
+    std::ifstream ifs(filepath, std::ios::binary);
+    if (!ifs)
+    {
+        std::ostringstream os;
+        os << "failed to open " << filepath;
+        throw std::runtime_error(os.str());
+    }
+
+    uint64_t hash = 14695981039346656037ULL;
+    char buf[64 * 1024];
+
+    while (ifs)
+    {
+        ifs.read(buf, sizeof(buf));
+        std::streamsize n = ifs.gcount();
+        for (std::streamsize i = 0; i < n; ++i)
+        {
+            hash ^= static_cast<unsigned char>(buf[i]);
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    std::ostringstream os;
+    os << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return os.str();
+}
+
+} // anonymous namespace
+
+file_manifest::file_manifest() {}
+
+void file_manifest::load(std::istream& is)
+{
+    store_type entries;
+    std::string line;
+    size_t line_no = 0;
+
+    // Each line consists of hash, size, mtime and path separated by tabs.
+    // The path comes last since it may contain spaces.
+    while (std::getline(is, line))
+    {
+        ++line_no;
+        if (line.empty())
+            continue;
+
+        std::istringstream ls(line);
+        entry e;
+        std::string path;
+
+        if (!(ls >> e.hash >> e.size >> e.mtime) || ls.get() != '\t' || !std::getline(ls, path) || path.empty())
+        {
+            std::ostringstream os;
+            os << "malformed manifest entry on line " << line_no;
+            throw std::runtime_error(os.str());
+        }
+
+        entries[path] = e;
+    }
+
+    m_entries.swap(entries);
+}
+
+void file_manifest::save(std::ostream& os) const
+{
+    for (const auto& item : m_entries)
+    {
+        const entry& e = item.second;
+        os << e.hash << '\t' << e.size << '\t' << e.mtime << '\t' << item.first << '\n';
+    }
+}
+
+const file_manifest::entry* file_manifest::find(const std::string& filepath) const
+{
+    auto it = m_entries.find(filepath);
+    return it == m_entries.end() ? nullptr : &it->second;
+}
+
+void file_manifest::set(const std::string& filepath, const entry& e)
+{
+    m_entries[filepath] = e;
+}
+
+void file_manifest::remove(const std::string& filepath)
+{
+    m_entries.erase(filepath);
+}
+
+const file_manifest::store_type& file_manifest::entries() const
+{
+    return m_entries;
+}
+
+file_manifest::entry file_manifest::stat_file(const std::string& filepath, const entry* ref)
+{
+    entry e;
+    e.size = fs::file_size(filepath);
+    e.mtime = fs::last_write_time(filepath);
+
+    if (ref && ref->size == e.size && ref->mtime == e.mtime)
+        e.hash = ref->hash;
+    else
+        e.hash = hash_file(filepath);
+
+    return e;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,65 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+/**
+ * Keeps track of the input files that have been processed, so that an
+ * incremental run only needs to parse the files that are new or have
+ * changed since the last run.
+ */
+class file_manifest
+{
+public:
+    struct entry
+    {
+        uint64_t size = 0;
+        std::time_t mtime = 0;
+        std::string hash; // content hash as a hex string.
+    };
+
+    using store_type = std::map<std::string, entry>;
+
+private:
+    store_type m_entries;
+
+public:
+    file_manifest();
+
+    void load(std::istream& is);
+
+    void save(std::ostream& os) const;
+
+    /**
+     * Find the entry for a file path.
+     *
+     * @return pointer to the entry, or nullptr if the file is not in the
+     *         manifest.
+     */
+    const entry* find(const std::string& filepath) const;
+
+    void set(const std::string& filepath, const entry& e);
+
+    void remove(const std::string& filepath);
+
+    const store_type& entries() const;
+
+    /**
+     * Create a new entry from the current state of a file on disk.  The
+     * content hash is only computed when the size or modification time
+     * differ from those of the reference entry, if given.
+     */
+    static entry stat_file(const std::string& filepath, const entry* ref = nullptr);
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,158 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "file_prefetcher.hpp"
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace fs = boost::filesystem;
+
+file_prefetcher::file::file(file_prefetcher& owner, const std::string& path, uint64_t reserved) :
+    m_owner(owner), m_path(path), m_reserved(reserved) {}
+
+file_prefetcher::file::~file()
+{
+    m_content.reset();
+    m_owner.release(m_reserved);
+}
+
+const std::string& file_prefetcher::file::path() const
+{
+    return m_path;
+}
+
+const char* file_prefetcher::file::data() const
+{
+    return m_content->data();
+}
+
+size_t file_prefetcher::file::size() const
+{
+    return m_content->size();
+}
+
+file_prefetcher::file_prefetcher(
+    const std::vector<std::string>& filepaths, size_t reader_count, uint64_t byte_budget) :
+    m_budget(byte_budget)
+{
+    if (!reader_count)
+        throw std::invalid_argument("reader count must be at least one.");
+
+    m_files.reserve(filepaths.size());
+
+    for (const std::string& filepath : filepaths)
+    {
+        boost::system::error_code ec;
+        uint64_t size = fs::file_size(filepath, ec);
+        if (ec)
+            // Let the reader report the error later.
+            size = 0;
+
+        m_files.push_back({&filepath, size});
+    }
+
+    // Largest first, so that the parsers do not end with a large file each.
+    std::stable_sort(m_files.begin(), m_files.end(),
+        [](const file_entry& l, const file_entry& r) { return l.size > r.size; });
+
+    for (size_t i = 0; i < reader_count; ++i)
+        m_readers.emplace_back(&file_prefetcher::run, this);
+}
+
+file_prefetcher::~file_prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_stop = true;
+    }
+
+    m_cond_space.notify_all();
+
+    for (std::thread& reader : m_readers)
+        reader.join();
+}
+
+void file_prefetcher::run()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        if (m_stop || m_next_file == m_files.size())
+            return;
+
+        const file_entry& fe = m_files[m_next_file++];
+
+        m_cond_space.wait(lock,
+            [this, &fe]() { return m_stop || !m_loaded_bytes || m_loaded_bytes + fe.size <= m_budget; });
+
+        if (m_stop)
+            return;
+
+        m_loaded_bytes += fe.size;
+        lock.unlock();
+
+        result res;
+
+        try
+        {
+            // Have the pages read in now, rather than on first access by
+            // the parser.
+            res.loaded.reset(new file(*this, *fe.path, fe.size));
+            res.loaded->m_content = std::make_unique<mapped_file>(*fe.path, mapped_file::map_prefault);
+        }
+        catch (const std::exception&)
+        {
+            res.loaded.reset(); // gives the reserved bytes back.
+            res.error = std::current_exception();
+        }
+
+        lock.lock();
+        m_ready.push_back(std::move(res));
+        lock.unlock();
+
+        m_cond_ready.notify_one();
+    }
+}
+
+void file_prefetcher::release(uint64_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_loaded_bytes -= bytes;
+    }
+
+    m_cond_space.notify_all();
+}
+
+std::unique_ptr<file_prefetcher::file> file_prefetcher::next()
+{
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_cond_ready.wait(lock,
+        [this]() { return !m_ready.empty() || m_handed_count == m_files.size(); });
+
+    if (m_ready.empty())
+        return nullptr;
+
+    result res = std::move(m_ready.front());
+    m_ready.pop_front();
+    ++m_handed_count;
+
+    // Wake up the other parsers if this was the last file.
+    if (m_handed_count == m_files.size())
+        m_cond_ready.notify_all();
+
+    lock.unlock();
+
+    if (res.error)
+        std::rethrow_exception(res.error);
+
+    return std::move(res.loaded);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,123 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "mapped_file.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Loads input files into memory on a set of reader threads ahead of the
+ * parser threads, so that the parsers do not wait on I/O.  Files are read
+ * largest first, and handed out in the order in which they finish loading.
+ * The total size of the files loaded but not yet released is kept within a
+ * byte budget, except that a file larger than the budget is still loaded
+ * when nothing else is.
+ */
+class file_prefetcher
+{
+public:
+    /**
+     * File loaded into memory.  Its bytes count against the budget until it
+     * is destroyed.
+     */
+    class file
+    {
+        friend class file_prefetcher;
+
+        file_prefetcher& m_owner;
+        const std::string& m_path;
+        uint64_t m_reserved; // bytes counted against the budget.
+        std::unique_ptr<mapped_file> m_content;
+
+        file(file_prefetcher& owner, const std::string& path, uint64_t reserved);
+
+    public:
+        ~file();
+
+        file(const file&) = delete;
+        file& operator= (const file&) = delete;
+
+        const std::string& path() const;
+
+        const char* data() const;
+
+        size_t size() const;
+    };
+
+private:
+    struct file_entry
+    {
+        const std::string* path;
+        uint64_t size;
+    };
+
+    struct result
+    {
+        std::unique_ptr<file> loaded;
+        std::exception_ptr error;
+    };
+
+    std::vector<file_entry> m_files; // largest first.
+    const uint64_t m_budget;
+
+    std::mutex m_mtx;
+    std::condition_variable m_cond_space; // readers wait for the budget.
+    std::condition_variable m_cond_ready; // parsers wait for loaded files.
+    std::deque<result> m_ready;
+    size_t m_next_file = 0; // next file to load.
+    size_t m_handed_count = 0; // files handed out to the parsers.
+    uint64_t m_loaded_bytes = 0; // bytes loaded and not yet released.
+    bool m_stop = false;
+
+    std::vector<std::thread> m_readers;
+
+    void run();
+
+    void release(uint64_t bytes);
+
+public:
+    /**
+     * Start loading files.
+     *
+     * @param filepaths paths of the files to load.  They must outlive the
+     *                  prefetcher.
+     * @param reader_count number of reader threads.
+     * @param byte_budget maximum number of bytes to keep loaded.
+     */
+    file_prefetcher(const std::vector<std::string>& filepaths, size_t reader_count, uint64_t byte_budget);
+
+    /**
+     * Stop the reader threads.  All files handed out must have been
+     * destroyed by then.
+     */
+    ~file_prefetcher();
+
+    file_prefetcher(const file_prefetcher&) = delete;
+    file_prefetcher& operator= (const file_prefetcher&) = delete;
+
+    /**
+     * Take the next loaded file, waiting for one if necessary.  This may be
+     * called from multiple threads.
+     *
+     * @return loaded file, or nullptr when all files have been handed out.
+     *
+     * @throw std::runtime_error if the file failed to load.
+     */
+    std::unique_ptr<file> next();
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
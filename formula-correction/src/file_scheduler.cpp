@@ -0,0 +1,150 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "file_scheduler.hpp"
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace fs = boost::filesystem;
+
+file_scheduler::file_scheduler(const std::vector<std::string>& filepaths, size_t worker_count) :
+    m_queues(std::make_unique<worker_queue[]>(worker_count)),
+    m_worker_count(worker_count)
+{
+    if (!worker_count)
+        throw std::invalid_argument("worker count must be at least one.");
+
+    m_files.reserve(filepaths.size());
+
+    for (const std::string& filepath : filepaths)
+    {
+        boost::system::error_code ec;
+        uint64_t size = fs::file_size(filepath, ec);
+        if (ec)
+            // Let the parser report the error later.
+            size = 0;
+
+        m_files.push_back({&filepath, size});
+    }
+
+    std::vector<size_t> order(m_files.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+
+    // Largest first.  Use the original position as a tie-breaker so that the
+    // schedule is deterministic.
+    std::sort(order.begin(), order.end(),
+        [this](size_t left, size_t right)
+        {
+            if (m_files[left].size != m_files[right].size)
+                return m_files[left].size > m_files[right].size;
+            return left < right;
+        }
+    );
+
+    // Deal each file to the worker with the least amount of pending work.
+    for (size_t i : order)
+    {
+        worker_queue* target = &m_queues[0];
+        for (size_t wi = 1; wi < m_worker_count; ++wi)
+        {
+            if (m_queues[wi].pending_bytes < target->pending_bytes)
+                target = &m_queues[wi];
+        }
+
+        target->files.push_back(i);
+        target->pending_bytes += m_files[i].size;
+    }
+}
+
+bool file_scheduler::pop_own(size_t worker, size_t& file)
+{
+    worker_queue& q = m_queues[worker];
+    std::lock_guard<std::mutex> lock(q.mtx);
+    if (q.files.empty())
+        return false;
+
+    file = q.files.front();
+    q.files.pop_front();
+    q.pending_bytes -= m_files[file].size;
+    return true;
+}
+
+bool file_scheduler::steal(size_t worker, size_t& file)
+{
+    while (true)
+    {
+        // Pick the worker with the most pending bytes.  Only one queue is
+        // locked at any given time.
+        size_t victim = m_worker_count;
+        uint64_t victim_bytes = 0;
+
+        for (size_t wi = 0; wi < m_worker_count; ++wi)
+        {
+            if (wi == worker)
+                continue;
+
+            worker_queue& q = m_queues[wi];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if (q.files.empty())
+                continue;
+
+            if (victim == m_worker_count || q.pending_bytes > victim_bytes)
+            {
+                victim = wi;
+                victim_bytes = q.pending_bytes;
+            }
+        }
+
+        if (victim == m_worker_count)
+            // Nothing left anywhere.
+            return false;
+
+        worker_queue& q = m_queues[victim];
+        std::lock_guard<std::mutex> lock(q.mtx);
+        if (q.files.empty())
+            // Someone else got there first.  Try again.
+            continue;
+
+        // The victim is busy with its current file.  Take the largest one
+        // still waiting in its queue, which is what it would have processed
+        // next.
+        file = q.files.front();
+        q.files.pop_front();
+        q.pending_bytes -= m_files[file].size;
+        return true;
+    }
+}
+
+const std::string* file_scheduler::next(size_t worker, bool& stolen)
+{
+    if (worker >= m_worker_count)
+        throw std::out_of_range("invalid worker index.");
+
+    size_t file = 0;
+    stolen = false;
+
+    if (pop_own(worker, file))
+        return m_files[file].path;
+
+    if (steal(worker, file))
+    {
+        stolen = true;
+        return m_files[file].path;
+    }
+
+    return nullptr;
+}
+
+size_t file_scheduler::worker_count() const
+{
+    return m_worker_count;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,66 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Distributes input files among worker threads.  Files are sorted by size
+ * (largest first) and dealt to the worker with the fewest pending bytes.
+ * Once a worker runs out of its own files, it steals the largest pending
+ * file from the worker that has the most bytes left.
+ */
+class file_scheduler
+{
+    struct worker_queue
+    {
+        std::mutex mtx;
+        std::deque<size_t> files; // indices into m_files, largest first.
+        uint64_t pending_bytes = 0;
+    };
+
+    struct file_entry
+    {
+        const std::string* path;
+        uint64_t size;
+    };
+
+    std::vector<file_entry> m_files;
+    std::unique_ptr<worker_queue[]> m_queues;
+    const size_t m_worker_count;
+
+    bool pop_own(size_t worker, size_t& file);
+
+    bool steal(size_t worker, size_t& file);
+
+public:
+    file_scheduler(const std::vector<std::string>& filepaths, size_t worker_count);
+
+    file_scheduler(const file_scheduler&) = delete;
+    file_scheduler& operator= (const file_scheduler&) = delete;
+
+    /**
+     * Fetch the next file to process for a worker.
+     *
+     * @param worker index of the calling worker.
+     * @param stolen set to true when the file was taken from another
+     *               worker's queue.
+     *
+     * @return pointer to the file path, or nullptr when no file is left.
+     */
+    const std::string* next(size_t worker, bool& stolen);
+
+    size_t worker_count() const;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,490 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "flat_trie.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
+
+namespace flat_trie_format {
+
+bool has_magic(const char* p, size_t n)
+{
+    return n >= sizeof(magic) && !std::memcmp(p, magic, sizeof(magic));
+}
+
+} // namespace flat_trie_format
+
+flat_trie_writer::flat_trie_writer(std::ostream& os) : m_os(os)
+{
+    // Reserve the space for the header, and start with the root node.
+    flat_trie_format::header header;
+    std::memset(&header, 0, sizeof(header));
+    m_os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    m_stack.push_back({0, 0, 0, {}});
+}
+
+void flat_trie_writer::write_nodes(const std::vector<node_type>& nodes)
+{
+    if (m_node_count + nodes.size() > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("flat_trie_writer: too many nodes.");
+
+    m_os.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(node_type));
+    m_node_count += nodes.size();
+}
+
+void flat_trie_writer::close_frame()
+{
+    frame& top = m_stack.back();
+
+    node_type nd;
+    nd.first_child = m_node_count;
+    nd.child_count = top.children.size();
+    nd.value = top.value;
+    nd.subtree_max = std::max(top.value, top.subtree_max);
+    nd.label = top.label;
+    nd.reserved = 0;
+
+    // The children are complete by now.  Write them out as one block.
+    write_nodes(top.children);
+
+    m_stack.pop_back();
+
+    frame& parent = m_stack.back();
+    parent.subtree_max = std::max(parent.subtree_max, nd.subtree_max);
+    parent.children.push_back(nd);
+}
+
+void flat_trie_writer::append(const uint16_t* key, size_t n, uint32_t value)
+{
+    if (m_finished)
+        throw std::logic_error("flat_trie_writer: already finished.");
+
+    if (!n || !value)
+        throw std::invalid_argument("flat_trie_writer: empty key or zero value.");
+
+    if (m_entry_count &&
+        !std::lexicographical_compare(m_last_key.begin(), m_last_key.end(), key, key + n))
+        throw std::invalid_argument("flat_trie_writer: keys are not in ascending order.");
+
+    // Length of the common prefix with the current path.  The stack holds
+    // the root plus one frame per key unit of the current path.
+    size_t depth = m_stack.size() - 1;
+    size_t common = 0;
+    while (common < depth && common < n && m_stack[common + 1].label == key[common])
+        ++common;
+
+    while (m_stack.size() - 1 > common)
+        close_frame();
+
+    for (size_t i = common; i < n; ++i)
+        m_stack.push_back({key[i], 0, 0, {}});
+
+    m_stack.back().value = value;
+    m_last_key.assign(key, key + n);
+    ++m_entry_count;
+}
+
+void flat_trie_writer::finish()
+{
+    if (m_finished)
+        return;
+
+    while (m_stack.size() > 1)
+        close_frame();
+
+    // Write the root's children followed by the root itself.
+    frame& root = m_stack.back();
+
+    node_type root_node;
+    root_node.first_child = m_node_count;
+    root_node.child_count = root.children.size();
+    root_node.value = 0;
+    root_node.subtree_max = root.subtree_max;
+    root_node.label = 0;
+    root_node.reserved = 0;
+
+    write_nodes(root.children);
+    write_nodes({root_node});
+
+    flat_trie_format::header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, flat_trie_format::magic, sizeof(header.magic));
+    header.version = flat_trie_format::version;
+    header.node_size = sizeof(node_type);
+    header.entry_count = m_entry_count;
+    header.node_count = m_node_count;
+    header.root = m_node_count - 1;
+    header.nodes_offset = sizeof(header);
+
+    std::streampos end_pos = m_os.tellp();
+    m_os.seekp(0);
+    m_os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_os.seekp(end_pos);
+
+    if (!m_os)
+        throw std::runtime_error("flat_trie_writer: failed to write the output.");
+
+    m_stack.clear();
+    m_finished = true;
+}
+
+flat_trie::flat_trie() {}
+
+flat_trie::flat_trie(const char* p, size_t n)
+{
+    using flat_trie_format::header;
+
+    if (n < sizeof(header) || !flat_trie_format::has_magic(p, n))
+        throw std::runtime_error("flat_trie: not a flat trie.");
+
+    header hd;
+    std::memcpy(&hd, p, sizeof(hd));
+
+    if (hd.version != flat_trie_format::version)
+        throw std::runtime_error("flat_trie: unsupported format version.");
+
+    if (hd.node_size != sizeof(node_type))
+        throw std::runtime_error("flat_trie: unexpected node size.");
+
+    if (hd.nodes_offset % alignof(node_type) || hd.nodes_offset > n ||
+        hd.node_count > (n - hd.nodes_offset) / sizeof(node_type) || hd.root >= hd.node_count)
+        throw std::runtime_error("flat_trie: truncated or corrupt data.");
+
+    m_nodes = reinterpret_cast<const node_type*>(p + hd.nodes_offset);
+    m_node_count = hd.node_count;
+    m_entry_count = hd.entry_count;
+    m_root = m_nodes + hd.root;
+}
+
+size_t flat_trie::size() const
+{
+    return m_entry_count;
+}
+
+size_t flat_trie::node_count() const
+{
+    return m_node_count;
+}
+
+const flat_trie::node_type& flat_trie::root() const
+{
+    if (!m_root)
+        throw std::logic_error("flat_trie: no trie is loaded.");
+
+    return *m_root;
+}
+
+void flat_trie::check_children(const node_type& nd) const
+{
+    if (uint64_t(nd.first_child) + nd.child_count > uint64_t(&nd - m_nodes))
+        throw std::runtime_error("flat_trie: truncated or corrupt data.");
+}
+
+const flat_trie::node_type* flat_trie::children_begin(const node_type& nd) const
+{
+    check_children(nd);
+    return m_nodes + nd.first_child;
+}
+
+const flat_trie::node_type* flat_trie::children_end(const node_type& nd) const
+{
+    check_children(nd);
+    return m_nodes + nd.first_child + nd.child_count;
+}
+
+const flat_trie::node_type* flat_trie::find_child(const node_type& nd, uint16_t label) const
+{
+    const node_type* first = children_begin(nd);
+    const node_type* last = children_end(nd);
+
+    const node_type* it = std::lower_bound(first, last, label,
+        [](const node_type& child, uint16_t v) { return child.label < v; });
+
+    if (it == last || it->label != label)
+        return nullptr;
+
+    return it;
+}
+
+const flat_trie::node_type* flat_trie::find_node(const uint16_t* key, size_t n) const
+{
+    if (!m_root)
+        return nullptr;
+
+    const node_type* nd = m_root;
+    for (size_t i = 0; i < n && nd; ++i)
+        nd = find_child(*nd, key[i]);
+
+    return nd;
+}
+
+uint32_t flat_trie::find(const uint16_t* key, size_t n) const
+{
+    const node_type* nd = find_node(key, n);
+    return nd ? nd->value : 0;
+}
+
+std::vector<flat_trie::entry> flat_trie::top_k(const uint16_t* prefix, size_t n, size_t k) const
+{
+    std::vector<entry> results;
+
+    const node_type* start = find_node(prefix, n);
+    if (!start || !k)
+        return results;
+
+    // Nodes reached so far, each with the position of its parent, for
+    // reconstructing the keys of the results.
+    struct path_node
+    {
+        const node_type* nd;
+        size_t parent;
+    };
+
+    // A candidate is either a node to expand, bounded by its sub-tree
+    // maximum, or an entry whose value is final.
+    struct candidate
+    {
+        uint32_t bound;
+        bool terminal;
+        size_t path;
+
+        bool operator< (const candidate& r) const
+        {
+            if (bound != r.bound)
+                return bound < r.bound;
+
+            // Prefer entries over nodes with the same bound, then the
+            // candidates found earlier.
+            if (terminal != r.terminal)
+                return !terminal;
+
+            return path > r.path;
+        }
+    };
+
+    std::vector<path_node> paths;
+    std::priority_queue<candidate> queue;
+
+    paths.push_back({start, 0});
+    queue.push({start->subtree_max, false, 0});
+
+    while (!queue.empty() && results.size() < k)
+    {
+        candidate c = queue.top();
+        queue.pop();
+
+        if (c.terminal)
+        {
+            entry e;
+            e.value = c.bound;
+            e.key.assign(prefix, prefix + n);
+
+            size_t depth = 0;
+            for (size_t pos = c.path; pos; pos = paths[pos].parent)
+            {
+                e.key.push_back(paths[pos].nd->label);
+                ++depth;
+            }
+
+            std::reverse(e.key.end() - depth, e.key.end());
+            results.push_back(std::move(e));
+            continue;
+        }
+
+        const node_type* nd = paths[c.path].nd;
+        if (nd->value)
+            queue.push({nd->value, true, c.path});
+
+        for (const node_type* child = children_begin(*nd); child != children_end(*nd); ++child)
+        {
+            paths.push_back({child, c.path});
+            queue.push({child->subtree_max, false, paths.size() - 1});
+        }
+    }
+
+    return results;
+}
+
+std::vector<flat_trie::match> flat_trie::find_nearest(
+    const uint16_t* key, size_t n, size_t max_distance, size_t max_results) const
+{
+    std::vector<match> results;
+
+    if (!m_root || !max_results)
+        return results;
+
+    // Distance table rows of all levels along the current path, each with
+    // n+1 columns.  The row at level 0 is the distance from the empty key.
+    const size_t width = n + 1;
+    std::vector<size_t> rows(width);
+    for (size_t i = 0; i < width; ++i)
+        rows[i] = i;
+
+    // Number of results found at each distance.
+    std::vector<size_t> hits;
+
+    key_type path;
+    std::vector<std::pair<const node_type*, const node_type*>> stack;
+    stack.emplace_back(children_begin(*m_root), children_end(*m_root));
+
+    while (!stack.empty())
+    {
+        auto& top = stack.back();
+        if (top.first == top.second)
+        {
+            stack.pop_back();
+            if (!stack.empty())
+            {
+                path.pop_back();
+                rows.resize(rows.size() - width);
+            }
+            continue;
+        }
+
+        const node_type& child = *top.first++;
+
+        // Compute the row for the child from that of its parent.
+        size_t prev = rows.size() - width;
+        rows.resize(rows.size() + width);
+        const size_t* above = rows.data() + prev;
+        size_t* row = rows.data() + prev + width;
+
+        row[0] = above[0] + 1;
+        size_t row_min = row[0];
+
+        for (size_t i = 1; i < width; ++i)
+        {
+            size_t cost = key[i-1] == child.label ? 0 : 1;
+            row[i] = std::min({above[i] + 1, row[i-1] + 1, above[i-1] + cost});
+            row_min = std::min(row_min, row[i]);
+        }
+
+        if (row_min > max_distance)
+        {
+            // No key under this node can get within the distance.
+            rows.resize(rows.size() - width);
+            continue;
+        }
+
+        path.push_back(child.label);
+
+        if (child.value && row[n] <= max_distance)
+        {
+            results.push_back({path, child.value, row[n]});
+
+            // Once there are enough results within a distance, no entry
+            // farther than that can make it into the results.
+            if (hits.size() <= row[n])
+                hits.resize(row[n] + 1, 0);
+
+            ++hits[row[n]];
+            size_t total = 0;
+            for (size_t d = 0; d < hits.size(); ++d)
+            {
+                total += hits[d];
+                if (total >= max_results)
+                {
+                    max_distance = d;
+                    break;
+                }
+            }
+        }
+
+        stack.emplace_back(children_begin(child), children_end(child));
+    }
+
+    std::sort(results.begin(), results.end(),
+        [](const match& l, const match& r)
+        {
+            if (l.distance != r.distance)
+                return l.distance < r.distance;
+
+            if (l.value != r.value)
+                return l.value > r.value;
+
+            return l.key < r.key;
+        }
+    );
+
+    if (results.size() > max_results)
+        results.resize(max_results);
+
+    return results;
+}
+
+flat_trie_cursor::flat_trie_cursor(const flat_trie& trie) :
+    flat_trie_cursor(trie, nullptr, 0) {}
+
+flat_trie_cursor::flat_trie_cursor(const flat_trie& trie, const uint16_t* prefix, size_t n) :
+    m_trie(&trie)
+{
+    const node_type* nd = trie.find_node(prefix, n);
+    if (!nd)
+        return;
+
+    m_key.assign(prefix, prefix + n);
+    m_stack.emplace_back(trie.children_begin(*nd), trie.children_end(*nd));
+
+    if (nd->value)
+    {
+        // The prefix itself is an entry.
+        m_value = nd->value;
+        return;
+    }
+
+    next();
+}
+
+bool flat_trie_cursor::valid() const
+{
+    return m_value != 0;
+}
+
+const flat_trie_cursor::key_type& flat_trie_cursor::key() const
+{
+    return m_key;
+}
+
+uint32_t flat_trie_cursor::value() const
+{
+    return m_value;
+}
+
+void flat_trie_cursor::next()
+{
+    m_value = 0;
+
+    while (!m_stack.empty())
+    {
+        auto& top = m_stack.back();
+        if (top.first == top.second)
+        {
+            m_stack.pop_back();
+            if (!m_stack.empty())
+                m_key.pop_back();
+            continue;
+        }
+
+        const node_type& child = *top.first++;
+        m_key.push_back(child.label);
+        m_stack.emplace_back(m_trie->children_begin(child), m_trie->children_end(child));
+
+        if (child.value)
+        {
+            m_value = child.value;
+            return;
+        }
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
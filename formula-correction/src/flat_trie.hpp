@@ -0,0 +1,337 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+/**
+ * Trie layout that can be queried in place, without deserialization, e.g.
+ * directly from a memory-mapped file.  All references between nodes are
+ * node indices, and all values are stored in the host byte order.
+ *
+ * The file consists of a fixed-size header followed by an array of nodes.
+ * The child nodes of each node are stored contiguously and are sorted by
+ * their labels.  Each node also stores the largest value in its sub-tree,
+ * which bounds the values reachable from it during top-k queries.
+ */
+namespace flat_trie_format {
+
+constexpr char magic[8] = { 'O', 'M', 'L', 'F', 'T', 'R', 'I', 'E' };
+constexpr uint32_t version = 2;
+
+struct header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t entry_count;
+    uint64_t node_count;
+    uint64_t root;
+    uint64_t nodes_offset;
+    uint64_t reserved[2];
+};
+
+struct node
+{
+    uint32_t first_child;
+    uint32_t child_count;
+    uint32_t value; // 0 if the node does not terminate a key.
+    uint32_t subtree_max; // largest value in the sub-tree including this node.
+    uint16_t label;
+    uint16_t reserved;
+};
+
+static_assert(sizeof(header) == 64, "unexpected header size");
+static_assert(sizeof(node) == 20, "unexpected node size");
+
+/**
+ * Check whether a buffer starts with the flat trie magic.
+ */
+bool has_magic(const char* p, size_t n);
+
+} // namespace flat_trie_format
+
+/**
+ * Writes a flat trie from entries given in strictly ascending key order.
+ * Nodes get written out as soon as their sub-trees are complete, so the
+ * memory use only depends on the length of the keys and the fan-out of the
+ * nodes along the current path, not on the number of entries.
+ */
+class flat_trie_writer
+{
+    using node_type = flat_trie_format::node;
+
+    struct frame
+    {
+        uint16_t label;
+        uint32_t value;
+        uint32_t subtree_max;
+        std::vector<node_type> children;
+    };
+
+    std::ostream& m_os;
+    std::vector<frame> m_stack;
+    std::vector<uint16_t> m_last_key;
+    uint64_t m_entry_count = 0;
+    uint64_t m_node_count = 0;
+    bool m_finished = false;
+
+    void close_frame();
+
+    void write_nodes(const std::vector<node_type>& nodes);
+
+public:
+    /**
+     * @param os seekable output stream.  The header is written last.
+     */
+    flat_trie_writer(std::ostream& os);
+
+    flat_trie_writer(const flat_trie_writer&) = delete;
+    flat_trie_writer& operator= (const flat_trie_writer&) = delete;
+
+    /**
+     * Append an entry.  The key must be non-empty, greater than the key of
+     * the previous entry, and the value must be non-zero.
+     */
+    void append(const uint16_t* key, size_t n, uint32_t value);
+
+    /**
+     * Write out the remaining nodes and the header.
+     */
+    void finish();
+};
+
+/**
+ * Read-only view of a flat trie stored in a memory buffer.  The buffer must
+ * outlive the view.
+ */
+class flat_trie
+{
+public:
+    using node_type = flat_trie_format::node;
+    using key_type = std::vector<uint16_t>;
+
+    struct entry
+    {
+        key_type key;
+        uint32_t value;
+    };
+
+    struct match
+    {
+        key_type key;
+        uint32_t value;
+        size_t distance;
+    };
+
+private:
+    const node_type* m_nodes = nullptr;
+    const node_type* m_root = nullptr;
+    size_t m_node_count = 0;
+    size_t m_entry_count = 0;
+
+    /**
+     * Check that the children of a node lie within the node array, before
+     * the node itself.  The writer always places them there, so this also
+     * rules out cycles in a corrupt file.
+     */
+    void check_children(const node_type& nd) const;
+
+public:
+    flat_trie();
+
+    /**
+     * Validate the header and set up the view.  The nodes are not all
+     * validated up-front, which would fault in every page of a mapped
+     * file.  Instead, the child range of each node is checked as the node
+     * gets expanded.
+     *
+     * @throw std::runtime_error if the buffer does not contain a valid flat
+     *        trie.  The queries throw it as well when they reach a corrupt
+     *        node.
+     */
+    flat_trie(const char* p, size_t n);
+
+    size_t size() const;
+
+    size_t node_count() const;
+
+    const node_type& root() const;
+
+    const node_type* children_begin(const node_type& nd) const;
+
+    const node_type* children_end(const node_type& nd) const;
+
+    /**
+     * Find the child node with the specified label.
+     *
+     * @return pointer to the child node, or nullptr if not found.
+     */
+    const node_type* find_child(const node_type& nd, uint16_t label) const;
+
+    /**
+     * Find the node reached by following a key from the root.
+     *
+     * @return pointer to the node, or nullptr if not found.
+     */
+    const node_type* find_node(const uint16_t* key, size_t n) const;
+
+    /**
+     * Find the value associated with a key.
+     *
+     * @return value associated with the key, or 0 if the key is not found.
+     */
+    uint32_t find(const uint16_t* key, size_t n) const;
+
+    /**
+     * Find the entries with the largest values among those whose keys start
+     * with the specified prefix.  The search expands the nodes in the order
+     * of their sub-tree maxima, and stops as soon as k entries have been
+     * found, so it only visits the sub-trees that can contain them.
+     *
+     * @return up to k entries in descending order of their values.  Entries
+     *         with the same value are in the order in which they are found.
+     */
+    std::vector<entry> top_k(const uint16_t* prefix, size_t n, size_t k) const;
+
+    /**
+     * Find the entries whose keys are within the specified edit distance of
+     * a key, counting each inserted, deleted or substituted key unit as one
+     * edit.  The search walks the trie while maintaining one row of the
+     * Levenshtein distance table per level, and skips the sub-tree of a node
+     * as soon as every value in its row exceeds the maximum distance.
+     *
+     * @param key key to compare against.
+     * @param n length of the key.
+     * @param max_distance maximum edit distance of the entries to return.
+     * @param max_results maximum number of entries to return.
+     *
+     * @return matching entries sorted by ascending distance, then by
+     *         descending value, then by ascending key.
+     */
+    std::vector<match> find_nearest(
+        const uint16_t* key, size_t n, size_t max_distance, size_t max_results) const;
+
+    /**
+     * Visit all entries under a node in ascending key order.
+     *
+     * @param nd node to start from.
+     * @param key key of the starting node.  This is used as the key buffer
+     *            during the traversal, and is restored before returning.
+     * @param func function to call with the key and the value of each
+     *             entry.
+     */
+    template<typename FuncT>
+    void for_each_under(const node_type& nd, key_type& key, FuncT func) const
+    {
+        if (nd.value)
+            func(static_cast<const key_type&>(key), nd.value);
+
+        // Each stack item holds the current and the end position among the
+        // children of a node on the current path.
+        std::vector<std::pair<const node_type*, const node_type*>> stack;
+        stack.emplace_back(children_begin(nd), children_end(nd));
+
+        while (!stack.empty())
+        {
+            auto& top = stack.back();
+            if (top.first == top.second)
+            {
+                stack.pop_back();
+                if (!stack.empty())
+                    key.pop_back();
+                continue;
+            }
+
+            const node_type& child = *top.first++;
+            key.push_back(child.label);
+
+            if (child.value)
+                func(static_cast<const key_type&>(key), child.value);
+
+            stack.emplace_back(children_begin(child), children_end(child));
+        }
+    }
+
+    /**
+     * Visit all entries in ascending key order.
+     */
+    template<typename FuncT>
+    void for_each(FuncT func) const
+    {
+        if (!m_root)
+            return;
+
+        key_type key;
+        for_each_under(*m_root, key, func);
+    }
+
+    /**
+     * Visit all entries whose keys start with the specified prefix, in
+     * ascending key order.
+     */
+    template<typename FuncT>
+    void for_each_prefix(const uint16_t* prefix, size_t n, FuncT func) const
+    {
+        const node_type* nd = find_node(prefix, n);
+        if (!nd)
+            return;
+
+        key_type key(prefix, prefix + n);
+        for_each_under(*nd, key, func);
+    }
+};
+
+/**
+ * Resumable in-order traversal of the entries of a flat trie.  It holds one
+ * position per level of the current key, and nothing more.
+ */
+class flat_trie_cursor
+{
+public:
+    using node_type = flat_trie::node_type;
+    using key_type = flat_trie::key_type;
+
+private:
+    const flat_trie* m_trie;
+    std::vector<std::pair<const node_type*, const node_type*>> m_stack;
+    key_type m_key;
+    uint32_t m_value = 0;
+
+public:
+    /**
+     * Position the cursor at the first entry of the trie.
+     */
+    flat_trie_cursor(const flat_trie& trie);
+
+    /**
+     * Position the cursor at the first entry whose key starts with the
+     * specified prefix.  The traversal is limited to such entries.
+     */
+    flat_trie_cursor(const flat_trie& trie, const uint16_t* prefix, size_t n);
+
+    /**
+     * @return true if the cursor points to an entry, false if the traversal
+     *         has finished.
+     */
+    bool valid() const;
+
+    const key_type& key() const;
+
+    uint32_t value() const;
+
+    /**
+     * Move to the next entry.
+     */
+    void next();
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
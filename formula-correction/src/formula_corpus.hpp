@@ -0,0 +1,368 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "types.hpp"
+
+#include <orcus/pstring.hpp>
+#include <ixion/formula_opcode.hpp>
+#include <ixion/formula_function_opcode.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * Compact binary alternative to the formula XML format.  A file starts with
+ * an 8-byte magic and a 4-byte version, followed by a sequence of records.
+ * Each record consists of a 1-byte record type, a 4-byte payload length and
+ * the payload.  All integers are unsigned and little-endian, and each
+ * string is stored as a 4-byte length followed by its bytes.  A payload may
+ * not exceed max_record_size.
+ *
+ * Record payloads:
+ *
+ * - doc: filepath (string).  Starts a document.
+ * - function: function name (string).  Appends a function to the function
+ *   table of the current document.  Function tokens refer to the functions
+ *   by their table positions.
+ * - sheet: sheet name (string).
+ * - named-expression: scope (1 byte, 0 = global, 1 = sheet), name (string),
+ *   sheet name (string, empty when global).
+ * - formula: sheet name (string), row (4 bytes), column (4 bytes), valid
+ *   (1 byte), formula (string), token count (4 bytes), tokens.
+ * - doc-end: empty.  Ends a document.
+ *
+ * Each token is stored as its 1-byte ixion opcode value, followed by a
+ * 2-byte function table position for a function token, or by the name
+ * (string) for a named expression token.
+ */
+namespace formula_corpus {
+
+constexpr char magic[8] = { 'O', 'M', 'L', 'F', 'C', 'O', 'R', 'P' };
+constexpr uint32_t version = 1;
+
+/**
+ * Largest payload accepted when parsing from a stream.  This is far more
+ * than any formula needs, and keeps a damaged length from causing a huge
+ * allocation.
+ */
+constexpr uint32_t max_record_size = 8 << 20;
+
+enum record_type : uint8_t
+{
+    rec_doc              = 1,
+    rec_function         = 2,
+    rec_sheet            = 3,
+    rec_named_expression = 4,
+    rec_formula          = 5,
+    rec_doc_end          = 6,
+};
+
+inline bool has_magic(const char* p, size_t n)
+{
+    if (n < sizeof(magic))
+        return false;
+
+    for (size_t i = 0; i < sizeof(magic); ++i)
+        if (p[i] != magic[i])
+            return false;
+
+    return true;
+}
+
+class parse_error : public std::runtime_error
+{
+public:
+    parse_error(const char* msg) : std::runtime_error(msg) {}
+};
+
+/**
+ * Bounds-checked reader of little-endian values.
+ */
+class buffer_reader
+{
+    const char* m_p;
+    const char* m_end;
+
+    void require(size_t n) const
+    {
+        if (size_t(m_end - m_p) < n)
+            throw parse_error("formula corpus: unexpected end of data.");
+    }
+
+public:
+    buffer_reader(const char* p, const char* end) : m_p(p), m_end(end) {}
+
+    bool empty() const { return m_p == m_end; }
+
+    const char* pos() const { return m_p; }
+
+    uint8_t u8()
+    {
+        require(1);
+        return static_cast<uint8_t>(*m_p++);
+    }
+
+    uint16_t u16()
+    {
+        require(2);
+        const auto* p = reinterpret_cast<const uint8_t*>(m_p);
+        m_p += 2;
+        return uint16_t(p[0]) | uint16_t(p[1]) << 8;
+    }
+
+    uint32_t u32()
+    {
+        require(4);
+        const auto* p = reinterpret_cast<const uint8_t*>(m_p);
+        m_p += 4;
+        return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+    }
+
+    orcus::pstring str()
+    {
+        uint32_t n = u32();
+        require(n);
+        orcus::pstring s(m_p, n);
+        m_p += n;
+        return s;
+    }
+
+    buffer_reader sub(size_t n)
+    {
+        require(n);
+        buffer_reader r(m_p, m_p + n);
+        m_p += n;
+        return r;
+    }
+};
+
+} // namespace formula_corpus
+
+/**
+ * Parser for the binary formula corpus format.  The handler receives the
+ * same calls as those generated from the XML format:
+ *
+ * <ul>
+ * <li>start_doc(const pstring& filepath)</li>
+ * <li>sheet(const pstring& name)</li>
+ * <li>named_expression(const pstring& name, bool global, const pstring& sheet)</li>
+ * <li>start_formula(const pstring& formula, const pstring& sheet, const pstring& row,
+ *                   const pstring& column, bool valid)</li>
+ * <li>token(ixion::fopcode_t opc, const pstring& s)</li>
+ * <li>function_token(ixion::formula_function_t fft)</li>
+ * <li>end_formula()</li>
+ * <li>end_doc()</li>
+ * </ul>
+ */
+template<typename HandlerT>
+class formula_corpus_parser
+{
+    formula_corpus::buffer_reader m_reader;
+    HandlerT& m_hdl;
+
+    /** function table of the current document. */
+    std::vector<ixion::formula_function_t> m_functions;
+
+    bool m_in_doc = false;
+
+    void parse_formula(formula_corpus::buffer_reader& r)
+    {
+        orcus::pstring sheet = r.str();
+        uint32_t row = r.u32();
+        uint32_t column = r.u32();
+        bool valid = r.u8() != 0;
+        orcus::pstring formula = r.str();
+
+        char row_buf[16], column_buf[16];
+        char* row_end = std::to_chars(row_buf, row_buf + sizeof(row_buf), row).ptr;
+        char* column_end = std::to_chars(column_buf, column_buf + sizeof(column_buf), column).ptr;
+
+        m_hdl.start_formula(
+            formula, sheet,
+            orcus::pstring(row_buf, row_end - row_buf),
+            orcus::pstring(column_buf, column_end - column_buf),
+            valid);
+
+        uint32_t token_count = r.u32();
+        for (uint32_t i = 0; i < token_count; ++i)
+        {
+            uint8_t op = r.u8();
+            if (op > ixion::fop_error)
+                throw formula_corpus::parse_error("formula corpus: invalid opcode.");
+
+            auto opc = static_cast<ixion::fopcode_t>(op);
+
+            switch (opc)
+            {
+                case ixion::fop_function:
+                {
+                    uint16_t pos = r.u16();
+                    if (pos >= m_functions.size())
+                        throw formula_corpus::parse_error("formula corpus: invalid function reference.");
+
+                    m_hdl.function_token(m_functions[pos]);
+                    break;
+                }
+                case ixion::fop_named_expression:
+                    m_hdl.token(opc, r.str());
+                    break;
+                default:
+                    m_hdl.token(opc, orcus::pstring());
+            }
+        }
+
+        m_hdl.end_formula();
+    }
+
+    void check_header(formula_corpus::buffer_reader& r)
+    {
+        using namespace formula_corpus;
+
+        for (size_t i = 0; i < sizeof(magic); ++i)
+        {
+            if (r.u8() != uint8_t(magic[i]))
+                throw parse_error("formula corpus: invalid magic.");
+        }
+
+        if (r.u32() != version)
+            throw parse_error("formula corpus: unsupported version.");
+    }
+
+    void parse_record(uint8_t type, formula_corpus::buffer_reader& r)
+    {
+        using namespace formula_corpus;
+
+        if (type != rec_doc && !m_in_doc)
+            throw parse_error("formula corpus: record outside of a document.");
+
+        switch (type)
+        {
+            case rec_doc:
+            {
+                if (m_in_doc)
+                    throw parse_error("formula corpus: nested document.");
+
+                m_in_doc = true;
+                m_functions.clear();
+                m_hdl.start_doc(r.str());
+                break;
+            }
+            case rec_function:
+            {
+                orcus::pstring name = r.str();
+                m_functions.push_back(to_formula_function(name.data(), name.size()));
+                break;
+            }
+            case rec_sheet:
+                m_hdl.sheet(r.str());
+                break;
+            case rec_named_expression:
+            {
+                bool global = r.u8() == 0;
+                orcus::pstring name = r.str();
+                orcus::pstring sheet = r.str();
+                m_hdl.named_expression(name, global, sheet);
+                break;
+            }
+            case rec_formula:
+                parse_formula(r);
+                break;
+            case rec_doc_end:
+                m_in_doc = false;
+                m_hdl.end_doc();
+                break;
+            default:
+                // Skip unknown record types for forward compatibility.
+                ;
+        }
+    }
+
+public:
+    formula_corpus_parser(const char* p, size_t n, HandlerT& hdl) :
+        m_reader(p, p + n), m_hdl(hdl) {}
+
+    /**
+     * Set up a parser for use with parse_stream() only.
+     */
+    formula_corpus_parser(HandlerT& hdl) :
+        m_reader(nullptr, nullptr), m_hdl(hdl) {}
+
+    void parse()
+    {
+        using namespace formula_corpus;
+
+        m_in_doc = false;
+        check_header(m_reader);
+
+        while (!m_reader.empty())
+        {
+            uint8_t type = m_reader.u8();
+            uint32_t len = m_reader.u32();
+            buffer_reader r = m_reader.sub(len);
+            parse_record(type, r);
+        }
+
+        if (m_in_doc)
+            throw parse_error("formula corpus: unterminated document.");
+    }
+
+    /**
+     * Parse data read from a stream one record at a time, so that only one
+     * record is held in memory at once.  The strings passed to the handler
+     * are only valid during each call.
+     *
+     * @param stream stream to read from.  Its read(char* buf, size_t n)
+     *               method must fill the buffer, unless the end of the data
+     *               is reached, and return the number of bytes read.
+     */
+    template<typename StreamT>
+    void parse_stream(StreamT& stream)
+    {
+        using namespace formula_corpus;
+
+        constexpr size_t header_size = sizeof(magic) + 4;
+        constexpr size_t record_header_size = 5;
+
+        std::vector<char> buf(header_size);
+        size_t n = stream.read(buf.data(), header_size);
+        buffer_reader header(buf.data(), buf.data() + n);
+
+        m_in_doc = false;
+        check_header(header);
+
+        while (true)
+        {
+            n = stream.read(buf.data(), record_header_size);
+            if (!n)
+                break;
+
+            buffer_reader rh(buf.data(), buf.data() + n);
+            uint8_t type = rh.u8();
+            uint32_t len = rh.u32();
+
+            if (len > max_record_size)
+                throw parse_error("formula corpus: record is too large.");
+
+            buf.resize(std::max<size_t>(len, header_size));
+            if (stream.read(buf.data(), len) != len)
+                throw parse_error("formula corpus: unexpected end of data.");
+
+            buffer_reader r(buf.data(), buf.data() + len);
+            parse_record(type, r);
+        }
+
+        if (m_in_doc)
+            throw parse_error("formula corpus: unterminated document.");
+    }
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,476 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "formula_xml_processor.hpp"
+#include "synthetic_corpus.hpp"
+#include "token_decoder.hpp"
+#include "trie_builder.hpp"
+#include "trie_loader.hpp"
+#include "types.hpp"
+
+#include <boost/program_options.hpp>
+#include <mdds/sorted_string_map.hpp>
+#include <ixion/formula_function_opcode.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+
+namespace po = boost::program_options;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace {
+
+std::atomic<size_t> allocation_count{0};
+
+} // anonymous namespace
+
+// Count every heap allocation made by the process.
+
+void* operator new(size_t n)
+{
+    ++allocation_count;
+    if (void* p = std::malloc(n ? n : 1))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t n)
+{
+    return operator new(n);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * Measurement of one stage for one corpus size.  Operations are formulas
+ * for all stages.
+ */
+struct result
+{
+    std::string stage;
+    size_t formulas = 0;
+    size_t bytes = 0;
+    double seconds = 0.0;
+    size_t allocations = 0;
+};
+
+struct corpus
+{
+    std::vector<std::string> documents; // XML, one string per document.
+    std::vector<std::vector<uint16_t>> formulas;
+    std::vector<std::string> op_names; // op attribute values.
+    std::vector<std::string> function_names;
+    size_t xml_bytes = 0;
+    size_t token_count = 0;
+};
+
+corpus generate_corpus(const synthetic_corpus::config& conf, size_t formula_count, size_t doc_formulas)
+{
+    corpus c;
+
+    synthetic_corpus gen(conf);
+    for (size_t remaining = formula_count; remaining; )
+    {
+        size_t n = std::min(remaining, doc_formulas);
+        c.documents.emplace_back();
+        gen.write_document(c.documents.back(), "synthetic-" + std::to_string(c.documents.size()), n);
+        c.xml_bytes += c.documents.back().size();
+        remaining -= n;
+    }
+
+    // Token sequences for the stages that skip the XML parsing.  These are
+    // generated separately, from the same seed.
+    synthetic_corpus tgen(conf);
+    std::vector<synthetic_corpus::token> tokens;
+    c.formulas.reserve(formula_count);
+    for (size_t i = 0; i < formula_count; ++i)
+    {
+        tgen.generate_formula(tokens);
+        c.formulas.push_back(encode_names_to_tokens(synthetic_corpus::to_names(tokens)));
+        c.token_count += tokens.size();
+
+        for (const synthetic_corpus::token& t : tokens)
+        {
+            c.op_names.push_back(t.op);
+            if (!std::strcmp(t.op, "function"))
+                c.function_names.push_back(t.s);
+        }
+    }
+
+    return c;
+}
+
+/**
+ * Run a stage several times and keep the fastest run.  The setup function
+ * runs before each timed run and is not measured.
+ */
+template<typename SetupT, typename FuncT>
+result measure(const char* stage, size_t repeat, SetupT setup, FuncT func)
+{
+    result best;
+    best.stage = stage;
+
+    for (size_t i = 0; i < repeat; ++i)
+    {
+        setup();
+
+        size_t alloc_start = allocation_count.load();
+        auto start = clock_type::now();
+        size_t bytes = func();
+        auto end = clock_type::now();
+        size_t allocs = allocation_count.load() - alloc_start;
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        if (!i || seconds < best.seconds)
+        {
+            best.seconds = seconds;
+            best.bytes = bytes;
+            best.allocations = allocs;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Look up the op and function names of the corpus, once through the
+ * perfect hash maps and once through the maps they replace.  Operations
+ * are names for these stages.
+ */
+std::vector<result> run_lookups(const corpus& c, size_t repeat)
+{
+    using op_map_type = mdds::sorted_string_map<ixion::fopcode_t>;
+
+    // Sorted op names, as in the former map of types.cpp.
+    std::vector<std::string> names;
+    for (size_t v = ixion::fop_unknown; v <= ixion::fop_error; ++v)
+        names.push_back(to_string(static_cast<ixion::fopcode_t>(v)).str());
+    std::sort(names.begin(), names.end());
+
+    std::vector<op_map_type::entry> entries;
+    for (const std::string& name : names)
+        entries.push_back({name.data(), name.size(), to_formula_op(name.data(), name.size())});
+
+    op_map_type sorted_map(entries.data(), entries.size(), ixion::fop_unknown);
+
+    size_t op_bytes = 0;
+    for (const std::string& name : c.op_names)
+        op_bytes += name.size();
+
+    size_t function_bytes = 0;
+    for (const std::string& name : c.function_names)
+        function_bytes += name.size();
+
+    // Accumulate the results so that the lookups are not optimized away.
+    volatile size_t sink = 0;
+
+    auto lookup_stage = [&](const char* stage, const std::vector<std::string>& keys, size_t bytes, auto func)
+    {
+        result r = measure(stage, repeat, []{},
+            [&]()
+            {
+                size_t sum = 0;
+                for (const std::string& key : keys)
+                    sum += size_t(func(key));
+                sink = sink + sum;
+                return bytes;
+            }
+        );
+
+        r.formulas = keys.size();
+        return r;
+    };
+
+    // Resolve the function names once up-front so that the perfect hash
+    // stage does not include building its map.
+    if (!c.function_names.empty())
+        to_formula_function(c.function_names[0].data(), c.function_names[0].size());
+
+    std::vector<result> results;
+
+    results.push_back(lookup_stage("op_lookup_sorted_map", c.op_names, op_bytes,
+        [&sorted_map](const std::string& s) { return sorted_map.find(s.data(), s.size()); }));
+
+    results.push_back(lookup_stage("op_lookup_perfect_hash", c.op_names, op_bytes,
+        [](const std::string& s) { return to_formula_op(s.data(), s.size()); }));
+
+    results.push_back(lookup_stage("function_lookup_ixion", c.function_names, function_bytes,
+        [](const std::string& s) { return ixion::get_formula_function_opcode(s.data(), s.size()); }));
+
+    results.push_back(lookup_stage("function_lookup_perfect_hash", c.function_names, function_bytes,
+        [](const std::string& s) { return to_formula_function(s.data(), s.size()); }));
+
+    return results;
+}
+
+std::vector<result> run_stages(const corpus& c, size_t repeat, trie_builder::build_mode mode)
+{
+    std::vector<result> results;
+    const size_t formula_count = c.formulas.size();
+
+    // xml_handler and formula_handler, including the insertion into the
+    // per-document tries.
+    {
+        formula_xml_processor proc("", "", false);
+        proc.set_build_mode(mode);
+        results.push_back(measure("parse", repeat, []{},
+            [&]()
+            {
+                formula_xml_processor::thread_context tc;
+                for (const std::string& doc : c.documents)
+                {
+                    std::ostringstream co;
+                    proc.parse_content(doc.data(), doc.size(), tc, co);
+                }
+                return c.xml_bytes;
+            }
+        ));
+    }
+
+    const size_t token_bytes = c.token_count * sizeof(uint16_t);
+
+    trie_builder trie(mode);
+    results.push_back(measure("insert_formula", repeat,
+        [&]() { trie_builder(mode).swap(trie); },
+        [&]()
+        {
+            for (const auto& tokens : c.formulas)
+                trie.insert_formula(tokens);
+            return token_bytes;
+        }
+    ));
+
+    // Merge eight partial tries into one, as the worker threads do.
+    constexpr size_t part_count = 8;
+    std::vector<trie_builder> parts;
+    trie_builder merged(mode);
+    results.push_back(measure("merge", repeat,
+        [&]()
+        {
+            parts.clear();
+            for (size_t i = 0; i < part_count; ++i)
+                parts.emplace_back(mode);
+            for (size_t i = 0; i < formula_count; ++i)
+                parts[i % part_count].insert_formula(c.formulas[i]);
+            trie_builder(mode).swap(merged);
+        },
+        [&]()
+        {
+            for (const trie_builder& part : parts)
+                merged.merge(part);
+            return token_bytes;
+        }
+    ));
+
+    std::string packed;
+    results.push_back(measure("write", repeat, []{},
+        [&]()
+        {
+            std::ostringstream os;
+            trie.write(os);
+            packed = os.str();
+            return packed.size();
+        }
+    ));
+
+    results.push_back(measure("write_flat", repeat, []{},
+        [&]()
+        {
+            std::ostringstream os;
+            trie.write_flat(os);
+            return size_t(os.tellp());
+        }
+    ));
+
+    trie_loader loader;
+    results.push_back(measure("load", repeat, []{},
+        [&]()
+        {
+            std::istringstream is(packed);
+            loader.load(is);
+            return packed.size();
+        }
+    ));
+
+    results.push_back(measure("dump", repeat, []{},
+        [&]()
+        {
+            std::ostringstream os;
+            loader.dump(os, trie_loader::NAME);
+            return size_t(os.tellp());
+        }
+    ));
+
+    for (result& r : results)
+        r.formulas = formula_count;
+
+    for (result& r : run_lookups(c, repeat))
+        results.push_back(r);
+
+    return results;
+}
+
+void write_json(
+    std::ostream& os, const synthetic_corpus::config& conf, size_t doc_formulas, size_t repeat,
+    trie_builder::build_mode mode, const std::vector<std::pair<size_t, std::vector<result>>>& runs)
+{
+    os << "{\n";
+    os << "  \"parameters\": {\n";
+    os << "    \"seed\": " << conf.seed << ",\n";
+    os << "    \"length-distribution\": \""
+       << (conf.length_distribution == synthetic_corpus::length_uniform ? "uniform" : "geometric") << "\",\n";
+    os << "    \"mean-length\": " << conf.mean_length << ",\n";
+    os << "    \"max-length\": " << conf.max_length << ",\n";
+    os << "    \"doc-formulas\": " << doc_formulas << ",\n";
+    os << "    \"repeat\": " << repeat << ",\n";
+    os << "    \"build-mode\": \"" << (mode == trie_builder::build_mode::sort ? "sort" : "trie") << "\"\n";
+    os << "  },\n";
+    os << "  \"results\": [";
+
+    bool first = true;
+    for (const auto& run : runs)
+    {
+        for (const result& r : run.second)
+        {
+            double formulas_per_second = r.seconds > 0.0 ? r.formulas / r.seconds : 0.0;
+            double mb_per_second = r.seconds > 0.0 ? r.bytes / r.seconds / 1.0e6 : 0.0;
+            double allocations_per_formula = r.formulas ? double(r.allocations) / r.formulas : 0.0;
+
+            os << (first ? "\n" : ",\n");
+            os << "    { \"stage\": \"" << r.stage << "\""
+               << ", \"corpus-formulas\": " << run.first
+               << ", \"bytes\": " << r.bytes
+               << ", \"seconds\": " << r.seconds
+               << ", \"formulas-per-second\": " << formulas_per_second
+               << ", \"mb-per-second\": " << mb_per_second
+               << ", \"allocations\": " << r.allocations
+               << ", \"allocations-per-formula\": " << allocations_per_formula
+               << " }";
+
+            first = false;
+        }
+    }
+
+    os << "\n  ]\n";
+    os << "}\n";
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+    synthetic_corpus::config conf;
+    std::vector<size_t> sizes;
+    std::string length_dist;
+    size_t doc_formulas = 1000;
+    size_t repeat = 3;
+    bool sort_build = false;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Print this help.")
+        ("formulas,n", po::value<std::vector<size_t>>(&sizes)->multitoken(),
+         "Corpus sizes in number of formulas.  Each stage is measured for each size.  The default is 10000 and 100000.")
+        ("doc-formulas", po::value<size_t>(&doc_formulas)->default_value(1000), "Number of formulas per document.")
+        ("length-dist", po::value<std::string>(&length_dist)->default_value("geometric"),
+         "Distribution of the formula lengths. Either 'uniform' or 'geometric'.")
+        ("mean-length", po::value<size_t>(&conf.mean_length)->default_value(8), "Mean number of tokens per formula.")
+        ("max-length", po::value<size_t>(&conf.max_length)->default_value(64), "Maximum number of tokens per formula.")
+        ("seed", po::value<uint64_t>(&conf.seed)->default_value(0), "Seed of the corpus generator.")
+        ("repeat,r", po::value<size_t>(&repeat)->default_value(3), "Number of runs per stage.  The fastest run is reported.")
+        ("sort-build", po::bool_switch(&sort_build), "Build the tries in the sort mode.")
+        ("output,o", po::value<std::string>(), "Output file.  The JSON report is written to the standard output if not given.");
+
+    po::variables_map vm;
+    try
+    {
+        po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+        po::notify(vm);
+    }
+    catch (const std::exception& e)
+    {
+        // Unknown options.
+        cout << e.what() << endl;
+        cout << desc;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("help"))
+    {
+        cout << desc;
+        return EXIT_SUCCESS;
+    }
+
+    if (length_dist == "uniform")
+        conf.length_distribution = synthetic_corpus::length_uniform;
+    else if (length_dist == "geometric")
+        conf.length_distribution = synthetic_corpus::length_geometric;
+    else
+    {
+        cerr << "invalid length distribution: " << length_dist << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (sizes.empty())
+        sizes = { 10000, 100000 };
+
+    repeat = std::max<size_t>(1, repeat);
+    doc_formulas = std::max<size_t>(1, doc_formulas);
+
+    auto mode = sort_build ? trie_builder::build_mode::sort : trie_builder::build_mode::trie;
+    std::vector<std::pair<size_t, std::vector<result>>> runs;
+
+    for (size_t n : sizes)
+    {
+        cerr << "corpus size: " << n << " formulas" << endl;
+        corpus c = generate_corpus(conf, n, doc_formulas);
+        runs.emplace_back(n, run_stages(c, repeat, mode));
+    }
+
+    if (vm.count("output"))
+    {
+        std::ofstream of(vm["output"].as<std::string>());
+        write_json(of, conf, doc_formulas, repeat, mode, runs);
+    }
+    else
+        write_json(cout, conf, doc_formulas, repeat, mode, runs);
+
+    return EXIT_SUCCESS;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
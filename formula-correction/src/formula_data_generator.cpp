@@ -0,0 +1,209 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "synthetic_corpus.hpp"
+
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <ixion/formula_function_opcode.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace {
+
+/**
+ * Parse a function mix given as comma-separated NAME=WEIGHT pairs.
+ */
+std::vector<std::pair<std::string, double>> parse_functions(const std::string& s)
+{
+    std::vector<std::pair<std::string, double>> functions;
+
+    std::vector<std::string> items;
+    boost::split(items, s, boost::is_any_of(","));
+
+    for (std::string item : items)
+    {
+        boost::trim(item);
+        if (item.empty())
+            continue;
+
+        std::string name = item;
+        double weight = 1.0;
+
+        size_t pos = item.find('=');
+        if (pos != std::string::npos)
+        {
+            name = item.substr(0, pos);
+            weight = std::stod(item.substr(pos + 1));
+        }
+
+        boost::trim(name);
+        boost::to_upper(name);
+
+        if (ixion::get_formula_function_opcode(name.data(), name.size()) == ixion::formula_function_t::func_unknown)
+            throw std::invalid_argument("unknown function: " + name);
+
+        if (weight < 0.0)
+            throw std::invalid_argument("negative weight: " + item);
+
+        functions.emplace_back(name, weight);
+    }
+
+    return functions;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+    synthetic_corpus::config conf;
+    size_t file_count = 0;
+    std::string length_dist;
+    std::string size_dist;
+    std::string functions;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Print this help.")
+        ("output,o", po::value<std::string>(), "Output directory.")
+        ("seed", po::value<uint64_t>(&conf.seed)->default_value(0), "Seed.  The same seed and options always produce the same files.")
+        ("files,n", po::value<size_t>(&file_count)->default_value(100), "Number of files to generate.")
+        ("size-dist", po::value<std::string>(&size_dist)->default_value("lognormal"),
+         "Distribution of the number of formulas per file. Either 'fixed', 'uniform' or 'lognormal'.")
+        ("mean-formulas", po::value<size_t>(&conf.mean_formulas)->default_value(1000), "Mean number of formulas per file.")
+        ("size-sigma", po::value<double>(&conf.size_sigma)->default_value(1.0),
+         "Sigma of the underlying normal distribution for the 'lognormal' file size distribution.")
+        ("length-dist", po::value<std::string>(&length_dist)->default_value("geometric"),
+         "Distribution of the formula lengths. Either 'uniform' or 'geometric'.")
+        ("mean-length", po::value<size_t>(&conf.mean_length)->default_value(8), "Mean number of tokens per formula.")
+        ("max-length", po::value<size_t>(&conf.max_length)->default_value(64), "Maximum number of tokens per formula.")
+        ("functions", po::value<std::string>(&functions),
+         "Function mix as comma-separated NAME=WEIGHT pairs, e.g. 'SUM=10,IF=5,VLOOKUP=2'.  A mix of common functions is used if not given.")
+        ("max-sheets", po::value<size_t>(&conf.max_sheets)->default_value(3), "Maximum number of sheets per file.")
+        ("named-expressions", po::value<size_t>(&conf.named_expressions)->default_value(4), "Number of named expressions defined per file.")
+        ("name-density", po::value<double>(&conf.named_expression_density)->default_value(0.02),
+         "Probability of a formula operand being a named expression.")
+        ("invalid-fraction", po::value<double>(&conf.invalid_fraction)->default_value(0.05),
+         "Fraction of invalid formulas.  Half of them have errors, the other half refer to undefined names.");
+
+    po::variables_map vm;
+    try
+    {
+        po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+        po::notify(vm);
+    }
+    catch (const std::exception& e)
+    {
+        // Unknown options.
+        cout << e.what() << endl;
+        cout << desc;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("help"))
+    {
+        cout << desc;
+        return EXIT_SUCCESS;
+    }
+
+    if (!vm.count("output"))
+    {
+        cerr << "output directory path is required." << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (length_dist == "uniform")
+        conf.length_distribution = synthetic_corpus::length_uniform;
+    else if (length_dist == "geometric")
+        conf.length_distribution = synthetic_corpus::length_geometric;
+    else
+    {
+        cerr << "invalid length distribution: " << length_dist << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (size_dist == "fixed")
+        conf.size_distribution = synthetic_corpus::size_fixed;
+    else if (size_dist == "uniform")
+        conf.size_distribution = synthetic_corpus::size_uniform;
+    else if (size_dist == "lognormal")
+        conf.size_distribution = synthetic_corpus::size_lognormal;
+    else
+    {
+        cerr << "invalid file size distribution: " << size_dist << endl;
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        conf.functions = parse_functions(functions);
+    }
+    catch (const std::exception& e)
+    {
+        cerr << "invalid function mix: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    fs::path output_dir(vm["output"].as<std::string>());
+
+    try
+    {
+        fs::create_directories(output_dir);
+    }
+    catch (const fs::filesystem_error& e)
+    {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    // The file sizes come from one generator, and the content of each file
+    // from its own generator, so that each file only depends on the seed
+    // and its position.
+    synthetic_corpus sizes(conf);
+    std::string buf;
+    size_t total_bytes = 0;
+
+    for (size_t i = 0; i < file_count; ++i)
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%08zu.xml", i);
+
+        synthetic_corpus::config doc_conf = conf;
+        doc_conf.seed = synthetic_corpus::document_seed(conf.seed, i);
+        synthetic_corpus gen(doc_conf);
+
+        buf.clear();
+        gen.write_document(buf, std::string("synthetic/") + name, sizes.document_size());
+
+        fs::path filepath = output_dir / name;
+        std::ofstream of(filepath.string(), std::ios::binary);
+        of.write(buf.data(), buf.size());
+
+        if (!of)
+        {
+            cerr << "failed to write " << filepath.string() << endl;
+            return EXIT_FAILURE;
+        }
+
+        total_bytes += buf.size();
+    }
+
+    cout << "files: " << file_count << ", bytes: " << total_bytes << endl;
+
+    return EXIT_SUCCESS;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
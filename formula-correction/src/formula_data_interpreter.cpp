@@ -6,13 +6,20 @@
  */
 
 #include "trie_loader.hpp"
+#include "token_decoder.hpp"
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
 #include <orcus/global.hpp>
 
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
@@ -35,12 +42,33 @@ trie_loader::mode_type to_mode_enum(const std::string& s)
 int main(int argc, char** argv)
 {
     bool verbose = false;
+    bool prefault = false;
+    bool hugepages = false;
+    size_t top_k = 10;
+    size_t max_distance = 2;
+    size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    size_t shard_count = 0;
+    trie_loader::dump_filter filter;
+    std::vector<std::string> functions;
 
     po::options_description desc("Allowed options");
     desc.add_options()
         ("help,h", "Print this help.")
         ("verbose,v", po::bool_switch(&verbose), "Verbose output.")
+        ("prefault", po::bool_switch(&prefault), "Fault in all pages of a memory-mapped input file up-front.")
+        ("hugepages", po::bool_switch(&hugepages), "Advise the kernel to back a memory-mapped input file with huge pages.")
         ("mode,m", po::value<std::string>(), "Interpretation mode. Either choose 'name', 'symbol' or 'value'.")
+        ("complete,c", po::value<std::string>(), "Print only the most frequent formula expressions that start with the specified tokens. Separate the tokens with spaces, and specify each token either by its name as printed in the 'name' mode, or by its value.")
+        ("correct", po::value<std::string>(), "Print only the formula expressions nearest to the specified tokens by token-level edit distance, each line starting with the distance. The tokens are specified in the same way as with --complete.")
+        ("max-distance,d", po::value<size_t>(&max_distance)->default_value(2), "Maximum edit distance of the formula expressions to print with --correct.")
+        ("top-k,k", po::value<size_t>(&top_k)->default_value(10), "Maximum number of formula expressions to print with --complete or --correct.")
+        ("min-count", po::value<uint32_t>(&filter.min_count)->default_value(0), "Print only the formula expressions that occur at least this many times.")
+        ("max-length", po::value<size_t>(&filter.max_length)->default_value(0), "Print only the formula expressions with at most this many tokens.  No limit if 0.")
+        ("function,f", po::value<std::vector<std::string>>(&functions), "Print only the formula expressions that contain the specified function.  This can be given more than once, in which case all functions must be present.")
+        ("threads,j", po::value<size_t>(&thread_count), "Number of threads to format the output with.  The default is the number of hardware threads.")
+        ("shards", po::value<size_t>(&shard_count)->default_value(0), "Split the output into the specified number of files named after the output file with a numeric suffix, e.g. out.txt.0000.  Each shard is in ascending order, and so are the shards.")
+        ("write-vocab", po::value<std::string>(), "Build a vocabulary of the tokens in the input file, which gives each token a dense identifier in descending order of frequency, write it to the specified file and exit.")
+        ("vocab", po::value<std::string>(), "Print the dense identifiers from the specified vocabulary file instead of the token values in the 'value' mode.  Tokens not in the vocabulary are printed as 0.")
         ("output,o", po::value<std::string>(), "Output file.");
 
     po::options_description hidden("Hidden options");
@@ -91,26 +119,177 @@ int main(int argc, char** argv)
     }
 
 
+    if (vm.count("complete") && vm.count("correct"))
+    {
+        cout << "--complete and --correct cannot be used together." << endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint16_t> query;
+    for (const char* name : { "complete", "correct" })
+    {
+        if (!vm.count(name))
+            continue;
+
+        std::istringstream is(vm[name].as<std::string>());
+        std::vector<std::string> names{std::istream_iterator<std::string>(is), std::istream_iterator<std::string>()};
+
+        try
+        {
+            query = encode_names_to_tokens(names);
+        }
+        catch (const std::exception& e)
+        {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (std::string name : functions)
+    {
+        if (name.compare(0, 5, "func:"))
+            name = "func:" + boost::to_upper_copy(name);
+
+        try
+        {
+            filter.required_tokens.push_back(encode_names_to_tokens({name}).front());
+        }
+        catch (const std::exception& e)
+        {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (vm.count("vocab") && mode != trie_loader::VALUE)
+    {
+        cerr << "--vocab can only be used in the 'value' mode." << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (shard_count && !vm.count("output"))
+    {
+        cerr << "--shards requires an output file." << endl;
+        return EXIT_FAILURE;
+    }
+
+    int map_flags = mapped_file::map_default;
+    if (prefault)
+        map_flags |= mapped_file::map_prefault;
+    if (hugepages)
+        map_flags |= mapped_file::map_hugepages;
+
     trie_loader trie;
 
+    try
     {
-        std::ifstream ifs(vm["input-file"].as<std::string>());
-        trie.load(ifs);
+        trie.load(vm["input-file"].as<std::string>(), map_flags);
+    }
+    catch (const std::exception& e)
+    {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
     }
 
     cout << "number of entries: " << trie.size() << endl;
 
-    std::ostream* is = &cout;
-    std::unique_ptr<std::ofstream> output;
+    if (vm.count("write-vocab"))
+    {
+        std::string vocab_path = vm["write-vocab"].as<std::string>();
+        token_vocab vocab;
+
+        try
+        {
+            vocab = token_vocab::build(trie.get(), thread_count);
+        }
+        catch (const std::exception& e)
+        {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+
+        std::ofstream of(vocab_path);
+        vocab.save(of);
+        of.close();
+
+        if (!of)
+        {
+            cerr << "failed to write " << vocab_path << endl;
+            return EXIT_FAILURE;
+        }
 
-    if (vm.count("output"))
+        cout << "vocabulary size: " << vocab.size() - 1 << endl;
+        return EXIT_SUCCESS;
+    }
+
+    token_vocab vocab;
+    if (vm.count("vocab"))
     {
-        std::string s = vm["output"].as<std::string>();
-        output = std::make_unique<std::ofstream>(s);
-        is = output.get();
+        std::string vocab_path = vm["vocab"].as<std::string>();
+        std::ifstream ifs(vocab_path);
+        if (!ifs)
+        {
+            cerr << "failed to open " << vocab_path << endl;
+            return EXIT_FAILURE;
+        }
+
+        try
+        {
+            vocab.load(ifs);
+        }
+        catch (const std::exception& e)
+        {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+
+        trie.set_vocab(&vocab);
     }
 
-    trie.dump(*is, mode);
+    // A corrupt file in the flat layout is only detected once the dump
+    // reaches the corrupt nodes.
+    try
+    {
+        if (shard_count)
+        {
+            std::string prefix = vm["output"].as<std::string>();
+            std::vector<std::unique_ptr<std::ofstream>> files;
+            std::vector<std::ostream*> shards;
+
+            for (size_t i = 0; i < shard_count; ++i)
+            {
+                char suffix[24];
+                std::snprintf(suffix, sizeof(suffix), ".%04zu", i);
+                files.push_back(std::make_unique<std::ofstream>(prefix + suffix, std::ios::binary));
+                shards.push_back(files.back().get());
+            }
+
+            trie.dump_shards(shards, mode, filter, thread_count);
+            return EXIT_SUCCESS;
+        }
+
+        std::ostream* is = &cout;
+        std::unique_ptr<std::ofstream> output;
+
+        if (vm.count("output"))
+        {
+            std::string s = vm["output"].as<std::string>();
+            output = std::make_unique<std::ofstream>(s);
+            is = output.get();
+        }
+
+        if (vm.count("complete"))
+            trie.dump_top_k(*is, query, top_k, mode);
+        else if (vm.count("correct"))
+            trie.dump_nearest(*is, query, max_distance, top_k, mode);
+        else
+            trie.dump(*is, mode, filter, thread_count);
+    }
+    catch (const std::exception& e)
+    {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,114 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "trie_loader.hpp"
+#include "atomic_write.hpp"
+#include "kway_merge.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <limits>
+
+namespace po = boost::program_options;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Print this help.")
+        ("output,o", po::value<std::string>(), "Output file to write the merged trie to, in the flat layout.");
+
+    po::options_description hidden("Hidden options");
+    hidden.add_options()
+        ("input-files", po::value<std::vector<std::string>>(), "input file");
+
+    po::options_description cmd_opt;
+    cmd_opt.add(desc).add(hidden);
+
+    po::positional_options_description po_desc;
+    po_desc.add("input-files", -1);
+
+    po::variables_map vm;
+    try
+    {
+        po::store(
+            po::command_line_parser(argc, argv).options(cmd_opt).positional(po_desc).run(), vm);
+        po::notify(vm);
+    }
+    catch (const std::exception& e)
+    {
+        // Unknown options.
+        cout << e.what() << endl;
+        cout << desc;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("help"))
+    {
+        cout << desc;
+        return EXIT_SUCCESS;
+    }
+
+    if (!vm.count("output"))
+    {
+        cerr << "output file path is required." << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!vm.count("input-files"))
+        return EXIT_SUCCESS;
+
+    std::vector<std::string> input_files = vm["input-files"].as<std::vector<std::string>>();
+
+    try
+    {
+        // Files in the flat layout get memory-mapped, so only the pages
+        // being merged need to be resident.
+        std::vector<trie_loader> tries(input_files.size());
+        std::vector<flat_trie_cursor> cursors;
+        cursors.reserve(input_files.size());
+
+        for (size_t i = 0; i < input_files.size(); ++i)
+        {
+            tries[i].load(input_files[i]);
+            cursors.emplace_back(tries[i].get());
+            cout << input_files[i] << ": " << tries[i].size() << " entries" << endl;
+        }
+
+        write_atomically(vm["output"].as<std::string>(),
+            [&cursors](std::ostream& os)
+            {
+                flat_trie_writer writer(os);
+
+                kway_merge(cursors,
+                    [&writer](const std::vector<uint16_t>& key, uint64_t count)
+                    {
+                        if (count > std::numeric_limits<uint32_t>::max())
+                            throw std::runtime_error("merged count is too large.");
+
+                        writer.append(key.data(), key.size(), count);
+                    }
+                );
+
+                writer.finish();
+            }
+        );
+    }
+    catch (const std::exception& e)
+    {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -8,6 +8,7 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 
+#include <fstream>
 #include <iostream>
 
 #include "formula_xml_processor.hpp"
@@ -21,12 +22,38 @@ using std::endl;
 int main(int argc, char** argv)
 {
     bool verbose = false;
+    bool incremental = false;
+    bool sort_build = false;
+    bool write_flat = false;
+    size_t slowest_count = 10;
+    size_t memory_limit = 0;
+    size_t read_ahead = 0;
+    size_t reader_count = 2;
 
     po::options_description desc("Allowed options");
     desc.add_options()
         ("help,h", "Print this help.")
         ("verbose,v", po::bool_switch(&verbose), "Verbose output.")
-        ("debug,d", po::value<std::string>(), "Debug output directory.")
+        ("incremental,i", po::bool_switch(&incremental),
+         "Update the formula-tokens.bin in the output directory by parsing only new or changed input files.")
+        ("sort-build", po::bool_switch(&sort_build),
+         "Collect the distinct formulas in flat per-thread buffers and build the trie from the sorted formulas at the end, "
+         "instead of inserting each formula into a trie.  This uses less memory and time, but cannot be combined with --incremental.")
+        ("memory-limit", po::value<size_t>(&memory_limit)->default_value(0),
+         "Memory budget in MiB for the formula data held by the worker threads, or 0 for no limit.  A worker that exceeds its share "
+         "writes its formulas to disk as a sorted run, and the runs get merged into formula-tokens.map at the end.  "
+         "No formula-tokens.bin is written in this mode, and it cannot be combined with --incremental.")
+        ("map", po::bool_switch(&write_flat),
+         "Also write the formula data to formula-tokens.map in a flat layout that can be memory-mapped and queried in place.  "
+         "It is many times the size of formula-tokens.bin.  It is always written with --memory-limit.")
+        ("read-ahead", po::value<size_t>(&read_ahead)->default_value(0),
+         "Load the input files into memory on dedicated reader threads ahead of the parsing threads, keeping up to the specified "
+         "number of MiB loaded ahead.  0 has each parsing thread read its own files.")
+        ("readers", po::value<size_t>(&reader_count)->default_value(2), "Number of reader threads for --read-ahead.")
+        ("stats", po::value<std::string>(),
+         "Write a JSON report with the time spent in each phase, the throughput, the rejected formulas and the slowest files to the specified file.")
+        ("stats-slowest", po::value<size_t>(&slowest_count)->default_value(10), "Number of the slowest files to list in the --stats report.")
+        ("debug,d", po::value<std::string>(), "Debug output directory.  A binary trace file per worker thread gets written to it.  Use formula-trace-render to convert them to text.")
         ("output,o", po::value<std::string>(), "Output directory.");
 
     po::options_description hidden("Hidden options");
@@ -66,6 +93,18 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
+    if (sort_build && incremental)
+    {
+        cerr << "--sort-build cannot be combined with --incremental." << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (memory_limit && incremental)
+    {
+        cerr << "--memory-limit cannot be combined with --incremental." << endl;
+        return EXIT_FAILURE;
+    }
+
     if (!vm.count("input-files"))
         return EXIT_SUCCESS;
 
@@ -100,8 +139,42 @@ int main(int argc, char** argv)
     }
 
     formula_xml_processor p(output_dir, debug_dir, verbose);
-    p.parse_files(input_files);
-    p.write_files();
+    p.set_slowest_file_count(slowest_count);
+
+    if (sort_build)
+        p.set_build_mode(trie_builder::build_mode::sort);
+
+    p.set_memory_limit(memory_limit << 20);
+    p.set_write_flat(write_flat);
+    p.set_read_ahead(read_ahead << 20, reader_count);
+
+    try
+    {
+        if (incremental)
+            p.parse_files_incremental(input_files);
+        else
+            p.parse_files(input_files);
+
+        p.write_files();
+    }
+    catch (const std::exception& e)
+    {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("stats"))
+    {
+        std::string stats_path = vm["stats"].as<std::string>();
+        std::ofstream of(stats_path);
+        p.write_stats(of);
+
+        if (!of)
+        {
+            cerr << "failed to write " << stats_path << endl;
+            return EXIT_FAILURE;
+        }
+    }
 
     return EXIT_SUCCESS;
 }
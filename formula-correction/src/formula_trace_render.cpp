@@ -0,0 +1,158 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "debug_trace.hpp"
+#include "formula_corpus.hpp"
+#include "token_decoder.hpp"
+
+#include <boost/program_options.hpp>
+#include <orcus/stream.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+namespace po = boost::program_options;
+using std::cout;
+using std::cerr;
+using std::endl;
+
+namespace {
+
+/**
+ * Render the records of a debug trace file in the same text form that the
+ * parser used to write directly.
+ */
+void render(std::ostream& os, const char* p, size_t n)
+{
+    if (!debug_trace_format::has_magic(p, n))
+        throw std::runtime_error("not a debug trace file.");
+
+    formula_corpus::buffer_reader reader(p + sizeof(debug_trace_format::magic), p + n);
+    if (reader.u32() != debug_trace_format::version)
+        throw std::runtime_error("unsupported debug trace version.");
+
+    std::vector<uint16_t> tokens;
+    std::vector<std::string_view> names;
+
+    while (!reader.empty())
+    {
+        uint8_t type = reader.u8();
+        uint32_t len = reader.u32();
+        formula_corpus::buffer_reader r = reader.sub(len);
+
+        switch (type)
+        {
+            case debug_trace_format::rec_doc:
+                os << "- filepath: " << r.str() << '\n'
+                   << "  formulas:" << '\n';
+                break;
+            case debug_trace_format::rec_formula:
+            {
+                orcus::pstring sheet = r.str();
+                orcus::pstring row = r.str();
+                orcus::pstring column = r.str();
+                orcus::pstring formula = r.str();
+
+                os << "    - sheet: " << sheet << '\n'
+                   << "      row: " << row << '\n'
+                   << "      column: " << column << '\n'
+                   << "      formula: " << formula << '\n';
+                break;
+            }
+            case debug_trace_format::rec_tokens:
+            {
+                tokens.resize(r.u32());
+                for (uint16_t& v : tokens)
+                    v = r.u16();
+
+                names.resize(tokens.size());
+                decode_tokens(tokens.data(), tokens.size(), token_string_table::names, names.data());
+
+                os << "      tokens: ";
+                for (std::string_view s : names)
+                    os << s << ' ';
+                os << '\n';
+                break;
+            }
+            default:
+                // Skip unknown records.
+                ;
+        }
+    }
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help,h", "Print this help.")
+        ("output,o", po::value<std::string>(), "Output file.  The text is written to the standard output if not given.");
+
+    po::options_description hidden("Hidden options");
+    hidden.add_options()
+        ("input-files", po::value<std::vector<std::string>>(), "input file");
+
+    po::options_description cmd_opt;
+    cmd_opt.add(desc).add(hidden);
+
+    po::positional_options_description po_desc;
+    po_desc.add("input-files", -1);
+
+    po::variables_map vm;
+    try
+    {
+        po::store(
+            po::command_line_parser(argc, argv).options(cmd_opt).positional(po_desc).run(), vm);
+        po::notify(vm);
+    }
+    catch (const std::exception& e)
+    {
+        // Unknown options.
+        cout << e.what() << endl;
+        cout << desc;
+        return EXIT_FAILURE;
+    }
+
+    if (vm.count("help"))
+    {
+        cout << desc;
+        return EXIT_SUCCESS;
+    }
+
+    if (!vm.count("input-files"))
+        return EXIT_SUCCESS;
+
+    std::ostream* os = &cout;
+    std::unique_ptr<std::ofstream> output;
+
+    if (vm.count("output"))
+    {
+        output = std::make_unique<std::ofstream>(vm["output"].as<std::string>());
+        os = output.get();
+    }
+
+    for (const std::string& filepath : vm["input-files"].as<std::vector<std::string>>())
+    {
+        try
+        {
+            orcus::file_content content(filepath.data());
+            render(*os, content.data(), content.size());
+        }
+        catch (const std::exception& e)
+        {
+            cerr << filepath << ": " << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -6,6 +6,13 @@
  */
 
 #include "formula_xml_processor.hpp"
+#include "atomic_write.hpp"
+#include "decompress_stream.hpp"
+#include "formula_corpus.hpp"
+#include "flat_trie.hpp"
+#include "kway_merge.hpp"
+#include "mapped_file.hpp"
+#include "perfect_hash.hpp"
 #include "types.hpp"
 #include "token_decoder.hpp"
 
@@ -18,6 +25,11 @@
 #include <orcus/string_pool.hpp>
 #include <ixion/formula_function_opcode.hpp>
 
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <limits>
+
 namespace fs = boost::filesystem;
 using std::endl;
 using orcus::pstring;
@@ -40,7 +52,34 @@ public:
     }
 };
 
-const char* token_labels[] = {
+void write_json_string(std::ostream& os, const std::string& s)
+{
+    os << '"';
+    for (char c : s)
+    {
+        switch (c)
+        {
+            case '"':
+                os << "\\\"";
+                break;
+            case '\\':
+                os << "\\\\";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    os << buf;
+                }
+                else
+                    os << c;
+        }
+    }
+    os << '"';
+}
+
+constexpr const char* token_labels[] = {
     "???",                // 0
     "column",             // 1
     "count",              // 2
@@ -86,27 +125,85 @@ constexpr orcus::xml_token_t XML_type               = 18;
 constexpr orcus::xml_token_t XML_op                 = 19;
 constexpr orcus::xml_token_t XML_valid              = 20;
 
-class xml_handler : public orcus::sax_token_handler
+// The SAX parser resolves the element and attribute names through
+// orcus::tokens.  This table only serves to keep the constants above in
+// sync with the labels at compile time.
+constexpr perfect_hash::static_map<orcus::xml_token_t, 21> token_label_map({
+    { "???", 0 },
+    { "column", XML_column },
+    { "count", XML_count },
+    { "doc", XML_doc },
+    { "error", XML_error },
+    { "filepath", XML_filepath },
+    { "formula", XML_formula },
+    { "formulas", XML_formulas },
+    { "name", XML_name },
+    { "named-expression", XML_named_expression },
+    { "named-expressions", XML_named_expressions },
+    { "origin", XML_origin },
+    { "row", XML_row },
+    { "s", XML_s },
+    { "scope", XML_scope },
+    { "sheet", XML_sheet },
+    { "sheets", XML_sheets },
+    { "token", XML_token },
+    { "type", XML_type },
+    { "op", XML_op },
+    { "valid", XML_valid },
+}, orcus::XML_UNKNOWN_TOKEN);
+
+constexpr bool check_token_labels()
 {
-    struct null_buffer : public std::streambuf
+    for (size_t i = 0; i < std::size(token_labels); ++i)
     {
-        int overflow(int c) { return c; }
-    };
+        if (token_label_map.find(token_labels[i]) != i)
+            return false;
+    }
+
+    return true;
+}
+
+static_assert(check_token_labels(), "token labels are out of sync.");
 
+/**
+ * Handles the content of a formula data file independent of its storage
+ * format.  It validates the formulas against the sheets and named
+ * expressions of each document, and inserts the encoded formula tokens into
+ * a trie.
+ */
+class formula_handler
+{
     // 3 bits (0-7) for token type (1-6),
     // 4 bits (0-15) for operator type (1-15),
     // 9 bits (0-511) for function type (1-323).
 
-    using token_set_t = std::unordered_set<orcus::xml_token_t>;
-    using xml_name_t = std::pair<orcus::xmlns_id_t, orcus::xml_token_t>;
     using name_set_t = std::unordered_set<pstring, pstring::hash>;
     using named_name_set_t = std::unordered_map<pstring, name_set_t, pstring::hash>;
     using str_counter_t = std::map<pstring, uint32_t>;
 
+    /** formula string and the sheet it is on. */
+    using formula_key_t = std::pair<pstring, pstring>;
+
+    struct formula_key_hash
+    {
+        size_t operator() (const formula_key_t& key) const
+        {
+            return pstring::hash()(key.first) * 31 + pstring::hash()(key.second);
+        }
+    };
+
+    /** encoded tokens of an accepted formula, and its count so far. */
+    struct cached_formula
+    {
+        std::vector<uint16_t> tokens;
+        int count;
+    };
+
+    using formula_cache_t = std::unordered_map<formula_key_t, cached_formula, formula_key_hash>;
+
     std::ostringstream& m_co; // console output buffer
     formula_xml_processor::thread_context& m_tc;
 
-    std::vector<xml_name_t> m_stack;
     std::vector<uint16_t> m_formula_tokens;
     name_set_t m_global_named_exps;
     named_name_set_t m_sheet_named_exps;
@@ -120,20 +217,26 @@ class xml_handler : public orcus::sax_token_handler
     str_counter_t m_invalid_formula_counts;
     str_counter_t m_invalid_name_counts;
 
+    /**
+     * Accepted formulas of the current document.  A repeated formula only
+     * increments its count, and the counts get added to the trie at the end
+     * of the document.  Rejected formulas are not cached, so that the names
+     * they fail on keep being counted.
+     */
+    formula_cache_t m_formula_cache;
+    formula_key_t m_cur_formula_key;
+    cached_formula* m_cur_cached = nullptr; // set when the current formula is a repeat.
+
     trie_builder m_trie;
     const bool m_verbose;
     bool m_valid_formula = false;
 
-    static void check_parent(const xml_name_t& parent, const orcus::xml_token_t expected)
+    void flush_formula_cache()
     {
-        if (parent != xml_name_t(orcus::XMLNS_UNKNOWN_ID, expected))
-            throw std::runtime_error("invalid structure");
-    }
+        for (const auto& entry : m_formula_cache)
+            m_trie.insert_formula(entry.second.tokens, entry.second.count);
 
-    static void check_parent(const xml_name_t& parent, const token_set_t expected)
-    {
-        if (!expected.count(parent.second))
-            throw std::runtime_error("invalid structure");
+        m_formula_cache.clear();
     }
 
     static uint16_t encode_function(const ixion::formula_function_t fft)
@@ -151,11 +254,11 @@ class xml_handler : public orcus::sax_token_handler
         return encoded;
     }
 
-    static void increment_name_count(str_counter_t& counter, const pstring& name)
+    void increment_name_count(str_counter_t& counter, const pstring& name)
     {
         auto it = counter.find(name);
         if (it == counter.end())
-            counter.insert({name, 1u});
+            counter.insert({m_str_pool.intern(name).first, 1u});
         else
             ++it->second;
     }
@@ -174,22 +277,98 @@ class xml_handler : public orcus::sax_token_handler
         return sheet_names.count(name);
     }
 
-    void start_doc(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    void push_token(ixion::fopcode_t opc, const pstring& s, ixion::formula_function_t fft)
     {
-        check_parent(parent, orcus::XML_UNKNOWN_TOKEN);
+        if (m_verbose)
+            m_co << "    * token: '" << s << "', op: " << to_string(opc);
 
-        for (const auto& attr : elem.attrs)
+        uint16_t encoded = opc - 1;
+
+        switch (opc)
         {
-            if (attr.name == XML_filepath)
-                m_filepath = attr.transient ? m_str_pool.intern(attr.value).first : attr.value;
+            case ixion::fop_function:
+            {
+                if (fft == ixion::formula_function_t::func_unknown)
+                    throw std::runtime_error("unknown function!");
+
+                encoded = encode_function(fft);
+
+                if (m_verbose)
+                    m_co << ", func-id: " << int(fft) << " (" << ixion::get_formula_function_name(fft) << ")";
+                break;
+            }
+            case ixion::fop_named_expression:
+            {
+                // Make sure the name actually exists in the document.
+                if (!name_exists(s, m_cur_formula_sheet))
+                {
+                    if (m_verbose)
+                        m_co << ", (name not found)";
+
+                    m_valid_formula = false;
+                    ++m_tc.counts.undefined_name;
+                    increment_name_count(m_invalid_name_counts, s);
+                }
+                break;
+            }
+            case ixion::fop_error:
+            {
+                // Don't process formula containing error tokens.
+                if (m_verbose)
+                    m_co << ", (skip this formula)";
+
+                m_valid_formula = false;
+                ++m_tc.counts.error_token;
+                break;
+            }
+            default:
+                ;
+        }
+
+        if (m_valid_formula)
+        {
+            m_formula_tokens.push_back(encoded);
+
+            if (m_verbose)
+                m_co << ", encoded: " << encoded;
         }
 
-        m_tc.debug_output << "- filepath: " << m_filepath << endl
-            << "  formulas:" << endl;
+        if (m_verbose)
+            m_co << endl;
+    }
+
+public:
+
+    formula_handler(
+        bool verbose, std::ostringstream& co, formula_xml_processor::thread_context& tc,
+        trie_builder::build_mode mode) :
+        m_co(co),
+        m_tc(tc),
+        m_trie(mode),
+        m_verbose(verbose) {}
+
+    void start_doc(const pstring& filepath)
+    {
+        // The strings passed in may not outlive the call when the input is
+        // streamed, so keep copies of those that need to.
+        m_filepath = m_str_pool.intern(filepath).first;
+
+        // A corpus may hold many documents, and the names defined in one
+        // must not validate the formulas of the next.
+        m_sheet_names.clear();
+        m_global_named_exps.clear();
+        m_sheet_named_exps.clear();
+        m_invalid_formula_counts.clear();
+        m_invalid_name_counts.clear();
+
+        if (m_tc.trace)
+            m_tc.trace->doc(m_filepath);
     }
 
     void end_doc()
     {
+        flush_formula_cache();
+
         bool print_report = !m_invalid_name_counts.empty() || !m_invalid_formula_counts.empty();
 
         if (!print_report)
@@ -215,49 +394,22 @@ class xml_handler : public orcus::sax_token_handler
         }
     }
 
-    void start_sheet(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    void sheet(const pstring& name)
     {
-        check_parent(parent, XML_sheets);
-
-        for (const auto& attr : elem.attrs)
-        {
-            if (attr.name == XML_name)
-            {
-                m_sheet_names.insert(m_str_pool.intern(attr.value).first);
+        m_sheet_names.insert(m_str_pool.intern(name).first);
 
-                if (m_verbose)
-                    m_co << "  * sheet: " << attr.value << endl;
-            }
-        }
+        if (m_verbose)
+            m_co << "  * sheet: " << name << endl;
     }
 
-    void start_named_expression(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    void named_expression(const pstring& name, bool global, const pstring& sheet)
     {
-        check_parent(parent, XML_named_expressions);
-
-        pstring name, scope, sheet;
         m_valid_formula = false;
 
-        for (const auto& attr : elem.attrs)
-        {
-            switch (attr.name)
-            {
-                case XML_name:
-                    name = attr.value;
-                    break;
-                case XML_scope:
-                    scope = attr.value;
-                    break;
-                case XML_sheet:
-                    sheet = attr.value;
-                    break;
-            }
-        }
-
         if (m_verbose)
-            m_co << "  * named expression: name: '" << name << "', scope: " << scope;
+            m_co << "  * named expression: name: '" << name << "', scope: " << (global ? "global" : "sheet");
 
-        if (scope == "global")
+        if (global)
             m_global_named_exps.insert(m_str_pool.intern(name).first);
         else
         {
@@ -274,7 +426,7 @@ class xml_handler : public orcus::sax_token_handler
 
             auto it = m_sheet_named_exps.find(sheet);
             if (it == m_sheet_named_exps.end())
-                it = m_sheet_named_exps.insert({sheet, name_set_t()}).first;
+                it = m_sheet_named_exps.insert({m_str_pool.intern(sheet).first, name_set_t()}).first;
 
             name_set_t& names = it->second;
             names.insert(m_str_pool.intern(name).first);
@@ -284,41 +436,18 @@ class xml_handler : public orcus::sax_token_handler
             m_co << endl;
     }
 
-    void start_formula(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    void start_formula(
+        const pstring& formula, const pstring& sheet, const pstring& row, const pstring& column, bool valid)
     {
-        check_parent(parent, XML_formulas);
-
-        pstring formula, sheet, row, column;
-
-        for (const auto& attr : elem.attrs)
-        {
-            switch (attr.name)
-            {
-                case XML_formula:
-                    formula = attr.value;
-                    break;
-                case XML_sheet:
-                    sheet = attr.value;
-                    break;
-                case XML_row:
-                    row = attr.value;
-                    break;
-                case XML_column:
-                    column = attr.value;
-                    break;
-                case XML_valid:
-                    m_valid_formula = attr.value == "true";
-                    break;
-            }
-        }
+        m_valid_formula = valid;
+        m_cur_cached = nullptr;
 
-        m_tc.debug_output << "    - sheet: " << sheet << endl
-            << "      row: " << row << endl
-            << "      column: " << column << endl
-            << "      formula: " << formula << endl;
+        if (m_tc.trace)
+            m_tc.trace->formula(sheet, row, column, formula);
 
         if (!m_valid_formula)
         {
+            ++m_tc.counts.invalid;
             increment_name_count(m_invalid_formula_counts, formula);
             return;
         }
@@ -327,7 +456,19 @@ class xml_handler : public orcus::sax_token_handler
         m_cur_formula_sheet = m_str_pool.intern(sheet).first;
 
         if (m_verbose)
+        {
+            // Log every token of every formula.
             m_co << "  * formula: " << formula << endl;
+            return;
+        }
+
+        // The formula string may be transient, and the cache key must
+        // outlive it.
+        m_cur_formula_key = formula_key_t(m_str_pool.intern(formula).first, m_cur_formula_sheet);
+
+        auto it = m_formula_cache.find(m_cur_formula_key);
+        if (it != m_formula_cache.end())
+            m_cur_cached = &it->second;
     }
 
     void end_formula()
@@ -335,110 +476,221 @@ class xml_handler : public orcus::sax_token_handler
         if (!m_valid_formula)
             return;
 
+        if (m_cur_cached)
+        {
+            // Repeated formula.  Its tokens have been skipped.
+            ++m_cur_cached->count;
+            ++m_tc.counts.accepted;
+            ++m_tc.counts.cached;
+            m_tc.counts.tokens += m_cur_cached->tokens.size();
+
+            if (m_tc.trace)
+                m_tc.trace->tokens(m_cur_cached->tokens.data(), m_cur_cached->tokens.size());
+
+            m_cur_cached = nullptr;
+            return;
+        }
+
         if (m_verbose)
             m_co << "    * formula tokens: " << m_formula_tokens.size() << endl;
 
-        if (m_tc.debug_output)
-        {
-            m_tc.debug_output << "      tokens: ";
+        ++m_tc.counts.accepted;
+        m_tc.counts.tokens += m_formula_tokens.size();
+
+        if (m_tc.trace)
+            m_tc.trace->tokens(m_formula_tokens.data(), m_formula_tokens.size());
 
-            for (const std::string& ts : decode_tokens_to_names(m_formula_tokens))
-                m_tc.debug_output << ts << ' ';
-            m_tc.debug_output << endl;
+        if (m_verbose)
+        {
+            m_trie.insert_formula(m_formula_tokens);
+            return;
         }
-        m_trie.insert_formula(m_formula_tokens);
+
+        m_formula_cache.insert({m_cur_formula_key, cached_formula{m_formula_tokens, 1}});
     }
 
-    void start_token(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    /**
+     * Add a token to the current formula.
+     *
+     * @param opc opcode of the token.
+     * @param s string value of the token.  It must be the function name for
+     *          a function token, and the name for a named expression token.
+     */
+    void token(ixion::fopcode_t opc, const pstring& s)
     {
-        check_parent(parent, {XML_formula, XML_named_expression});
+        if (!m_valid_formula || m_cur_cached)
+            return;
 
-        if (!m_valid_formula)
+        if (opc == ixion::fop_unknown)
+            throw std::runtime_error("unknown operator!");
+
+        ixion::formula_function_t fft = ixion::formula_function_t::func_unknown;
+        if (opc == ixion::fop_function)
+            fft = to_formula_function(s.data(), s.size());
+
+        push_token(opc, s, fft);
+    }
+
+    /**
+     * Add a function token whose function has already been resolved.
+     */
+    void function_token(ixion::formula_function_t fft)
+    {
+        if (!m_valid_formula || m_cur_cached)
             return;
 
-        pstring s, type, op;
+        push_token(ixion::fop_function, pstring(), fft);
+    }
+
+    bool valid_formula() const
+    {
+        return m_valid_formula;
+    }
+
+    void pop_trie(trie_builder& trie)
+    {
+        flush_formula_cache();
+        m_trie.swap(trie);
+    }
+};
+
+/**
+ * Translates the SAX events of a formula XML file into formula_handler
+ * calls.
+ */
+class xml_handler : public orcus::sax_token_handler
+{
+    using token_set_t = std::initializer_list<orcus::xml_token_t>;
+    using xml_name_t = std::pair<orcus::xmlns_id_t, orcus::xml_token_t>;
+
+    formula_handler& m_hdl;
+    std::vector<xml_name_t> m_stack;
+    orcus::string_pool m_str_pool;
+
+    static void check_parent(const xml_name_t& parent, const orcus::xml_token_t expected)
+    {
+        if (parent != xml_name_t(orcus::XMLNS_UNKNOWN_ID, expected))
+            throw std::runtime_error("invalid structure");
+    }
+
+    static void check_parent(const xml_name_t& parent, const token_set_t expected)
+    {
+        if (parent.first != orcus::XMLNS_UNKNOWN_ID ||
+            std::find(expected.begin(), expected.end(), parent.second) == expected.end())
+            throw std::runtime_error("invalid structure");
+    }
+
+    void start_doc(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    {
+        check_parent(parent, orcus::XML_UNKNOWN_TOKEN);
+
+        pstring filepath;
+
+        for (const auto& attr : elem.attrs)
+        {
+            if (attr.name == XML_filepath)
+                filepath = attr.transient ? m_str_pool.intern(attr.value).first : attr.value;
+        }
+
+        m_hdl.start_doc(filepath);
+    }
+
+    void start_sheet(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    {
+        check_parent(parent, XML_sheets);
+
+        for (const auto& attr : elem.attrs)
+        {
+            if (attr.name == XML_name)
+                m_hdl.sheet(attr.value);
+        }
+    }
+
+    void start_named_expression(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    {
+        check_parent(parent, XML_named_expressions);
+
+        pstring name, scope, sheet;
 
         for (const auto& attr : elem.attrs)
         {
             switch (attr.name)
             {
-                case XML_s:
-                    s = attr.value;
+                case XML_name:
+                    name = attr.value;
                     break;
-                case XML_type:
-                    type = attr.value;
+                case XML_scope:
+                    scope = attr.value;
                     break;
-                case XML_op:
-                    op = attr.value;
+                case XML_sheet:
+                    sheet = attr.value;
                     break;
             }
         }
 
-        ixion::fopcode_t opc = to_formula_op(op.data(), op.size());
-        if (opc == ixion::fop_unknown)
-            throw std::runtime_error("unknown operator!");
+        m_hdl.named_expression(name, scope == "global", sheet);
+    }
 
-        if (m_verbose)
-            m_co << "    * token: '" << s << "', op: " << op;
+    void start_formula(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    {
+        check_parent(parent, XML_formulas);
 
-        uint16_t encoded = opc - 1;
+        pstring formula, sheet, row, column;
+        bool valid = false;
 
-        switch (opc)
+        for (const auto& attr : elem.attrs)
         {
-            case ixion::fop_function:
+            switch (attr.name)
             {
-                ixion::formula_function_t fft = ixion::get_formula_function_opcode(s.data(), s.size());
-                if (fft == ixion::formula_function_t::func_unknown)
-                    throw std::runtime_error("unknown function!");
+                case XML_formula:
+                    formula = attr.value;
+                    break;
+                case XML_sheet:
+                    sheet = attr.value;
+                    break;
+                case XML_row:
+                    row = attr.value;
+                    break;
+                case XML_column:
+                    column = attr.value;
+                    break;
+                case XML_valid:
+                    valid = attr.value == "true";
+                    break;
+            }
+        }
 
-                encoded = encode_function(fft);
+        m_hdl.start_formula(formula, sheet, row, column, valid);
+    }
 
-                if (m_verbose)
-                    m_co << ", func-id: " << int(fft) << " (" << ixion::get_formula_function_name(fft) << ")";
-                break;
-            }
-            case ixion::fop_named_expression:
-            {
-                // Make sure the name actually exists in the document.
-                if (!name_exists(s, m_cur_formula_sheet))
-                {
-                    if (m_verbose)
-                        m_co << ", (name not found)";
+    void start_token(const xml_name_t parent, const orcus::xml_token_element_t& elem)
+    {
+        check_parent(parent, {XML_formula, XML_named_expression});
 
-                    m_valid_formula = false;
-                    increment_name_count(m_invalid_name_counts, s);
-                }
-                break;
-            }
-            case ixion::fop_error:
-            {
-                // Don't process formula containing error tokens.
-                if (m_verbose)
-                    m_co << ", (skip this formula)";
+        if (!m_hdl.valid_formula())
+            return;
 
-                m_valid_formula = false;
-                break;
-            }
-        }
+        pstring s, op;
 
-        if (m_valid_formula)
+        for (const auto& attr : elem.attrs)
         {
-            m_formula_tokens.push_back(encoded);
-
-            if (m_verbose)
-                m_co << ", encoded: " << encoded;
+            switch (attr.name)
+            {
+                case XML_s:
+                    s = attr.value;
+                    break;
+                case XML_op:
+                    op = attr.value;
+                    break;
+            }
         }
 
-        if (m_verbose)
-            m_co << endl;
+        m_hdl.token(to_formula_op(op.data(), op.size()), s);
     }
 
 public:
 
-    xml_handler(bool verbose, std::ostringstream& co, formula_xml_processor::thread_context& tc) :
-        m_co(co),
-        m_tc(tc),
-        m_verbose(verbose) {}
+    xml_handler(formula_handler& hdl) : m_hdl(hdl) {}
 
     void start_element(const orcus::xml_token_element_t& elem)
     {
@@ -505,12 +757,12 @@ public:
             {
                 case XML_formula:
                 {
-                    end_formula();
+                    m_hdl.end_formula();
                     break;
                 }
                 case XML_doc:
                 {
-                    end_doc();
+                    m_hdl.end_doc();
                     break;
                 }
             }
@@ -518,104 +770,382 @@ public:
 
         m_stack.pop_back();
     }
-
-    void pop_trie(trie_builder& trie)
-    {
-        m_trie.swap(trie);
-    }
 };
 
 } // anonymous namespace
 
-trie_builder formula_xml_processor::launch_worker_thread(const path_pos_pair_type& filepaths) const
+void formula_xml_processor::launch_worker_thread(
+    file_scheduler& scheduler, file_prefetcher* prefetcher, trie_reducer& reducer, size_t worker,
+    worker_stats& stats, debug_trace_writer* trace_writer) const
 {
-    trie_builder trie;
+    using clock_type = std::chrono::steady_clock;
+    auto start_time = clock_type::now();
+
+    trie_builder trie(m_build_mode);
     thread_context tc;
 
-    if (!m_debug_dir.empty())
+    if (trace_writer)
     {
-        // Create a debug log file.
+        // Create a debug trace file.
         std::ostringstream filename;
-        filename << std::this_thread::get_id() << ".log";
+        filename << "worker-" << worker << ".trace";
 
         fs::path debug_file_path = m_debug_dir / filename.str();
-        tc.debug_output.open(debug_file_path.string(), std::ios::binary);
+        tc.trace = &trace_writer->open_channel(debug_file_path.string());
     }
 
-    std::for_each(filepaths.first, filepaths.second,
-        [&trie, &tc, this](const std::string& filepath)
+    // Keeps the slowest files, with the fastest of them at the front.
+    auto slower = [](const file_time& l, const file_time& r) { return l.time > r.time; };
+
+    bool stolen = false;
+    std::unique_ptr<file_prefetcher::file> loaded;
+
+    auto next_file = [&]() -> const std::string*
+    {
+        if (!prefetcher)
+            return scheduler.next(worker, stolen);
+
+        // Time spent waiting for the reader threads counts as reading.
+        phase_timer timer;
+        loaded = prefetcher->next();
+        timer.lap(stats.read);
+        return loaded ? &loaded->path() : nullptr;
+    };
+
+    for (const std::string* filepath = next_file(); filepath; filepath = next_file())
+    {
+        auto file_start = clock_type::now();
+        size_t bytes_before = stats.bytes_read;
+        trie_builder this_trie = loaded ?
+            parse_file(*filepath, loaded->data(), loaded->size(), tc, stats) :
+            parse_file(*filepath, tc, stats);
+
+        // Give the bytes back to the budget of the reader threads.
+        loaded.reset();
+
+        duration_type file_time = clock_type::now() - file_start;
+        auto& slowest = stats.slowest_files;
+
+        if (slowest.size() < m_slowest_file_count || (!slowest.empty() && slowest.front().time < file_time))
+        {
+            slowest.push_back({*filepath, stats.bytes_read - bytes_before, file_time});
+            std::push_heap(slowest.begin(), slowest.end(), slower);
+
+            if (slowest.size() > m_slowest_file_count)
+            {
+                std::pop_heap(slowest.begin(), slowest.end(), slower);
+                slowest.pop_back();
+            }
+        }
+
+        if (!m_contrib_dir.empty())
         {
-            trie_builder this_trie = parse_file(filepath, tc);
-            trie.merge(this_trie);
+            // Keep the contribution of this file so that it can be
+            // subtracted once the file changes.
+            const file_manifest::entry* e = m_manifest.find(*filepath);
+            if (!e)
+                throw std::logic_error("input file is missing from the manifest.");
+
+            write_atomically(get_contrib_path(e->hash),
+                [&this_trie](std::ostream& os) { this_trie.write(os); });
         }
-    );
 
-    return trie;
+        phase_timer merge_timer;
+        trie.merge(this_trie);
+        merge_timer.lap(stats.local_merge);
+
+        if (m_memory_limit && trie.memory_size() > m_memory_limit / scheduler.worker_count())
+        {
+            stats.runs.push_back(spill_run(trie));
+            merge_timer.lap(stats.spill);
+        }
+
+        stats.busy_time += clock_type::now() - file_start;
+
+        ++stats.file_count;
+        if (stolen)
+            ++stats.stolen_count;
+    }
+
+    auto merge_start = clock_type::now();
+
+    if (m_memory_limit)
+    {
+        // The remaining entries go to a run of their own, and all runs get
+        // merged when writing.
+        if (trie.size())
+        {
+            phase_timer spill_timer;
+            stats.runs.push_back(spill_run(trie));
+            spill_timer.lap(stats.spill);
+        }
+    }
+    else
+    {
+        phase_timer reduce_timer;
+        reducer.reduce(std::move(trie));
+        reduce_timer.lap(stats.reduce);
+    }
+
+    auto end_time = clock_type::now();
+
+    stats.counts = tc.counts;
+
+    stats.merge_time = end_time - merge_start;
+    stats.total_time = end_time - start_time;
+}
+
+trie_builder formula_xml_processor::parse_file(
+    const std::string& filepath, thread_context& tc, worker_stats& stats) const
+{
+    phase_timer timer;
+    orcus::file_content content(filepath.data());
+    timer.lap(stats.read);
+
+    return parse_file(filepath, content.data(), content.size(), tc, stats);
 }
 
-trie_builder formula_xml_processor::parse_file(const std::string& filepath, thread_context& tc) const
+trie_builder formula_xml_processor::parse_file(
+    const std::string& filepath, const char* p, size_t n, thread_context& tc, worker_stats& stats) const
 {
     std::ostringstream co; // console output
 
-    orcus::file_content content(filepath.data());
+    phase_timer timer;
+    stats.bytes_read += n;
+
     co << "--" << endl;
-    co << "filepath: " << filepath << " (size: " << content.size() << ")" << endl;
+    co << "filepath: " << filepath << " (size: " << n << ")" << endl;
 
-    orcus::xmlns_repository repo;
-    auto cxt = repo.create_context();
-    xml_handler hdl(m_verbose, co, tc);
-    orcus::tokens token_map(token_labels, ORCUS_N_ELEMENTS(token_labels));
-    orcus::sax_token_parser<xml_handler> parser(content.data(), content.size(), token_map, cxt, hdl);
+    trie_builder trie = parse_content(p, n, tc, co);
+    timer.lap(stats.parse);
+
+    std::cout << co.str();
+    return trie;
+}
+
+trie_builder formula_xml_processor::parse_content(
+    const char* p, size_t n, thread_context& tc, std::ostringstream& co) const
+{
+    // The formulas of a file that fails to parse are not counted.
+    const formula_counts counts = tc.counts;
+    formula_handler hdl(m_verbose, co, tc, m_build_mode);
 
-    try
+    if (decompress_stream::detect(p, n) != decompress_stream::none)
     {
-        parser.parse();
+        bool corpus = false;
+
+        try
+        {
+            // Peek at the start of the decompressed data to tell the formats
+            // apart.
+            char head[sizeof(formula_corpus::magic)];
+            size_t head_size = decompress_stream(p, n).read(head, sizeof(head));
+            corpus = formula_corpus::has_magic(head, head_size);
+
+            if (!corpus)
+            {
+                // The XML parser needs the whole content in memory.
+                std::string content = decompress_stream(p, n).read_all();
+                return parse_content(content.data(), content.size(), tc, co);
+            }
+
+            // The binary formula corpus gets parsed while being decompressed.
+            decompress_stream stream(p, n);
+            formula_corpus_parser<formula_handler> parser(hdl);
+            parser.parse_stream(stream);
+        }
+        catch (const std::exception& e)
+        {
+            co << endl;
+            co << "  " << (corpus ? "corpus parse" : "decompression") << " error: " << e.what() << endl;
+            tc.counts = counts;
+            ++tc.counts.failed_files;
+            return trie_builder(m_build_mode);
+        }
     }
-    catch (const std::exception& e)
+    else if (formula_corpus::has_magic(p, n))
     {
-        co << endl;
-        co << "  XML parse error: " << e.what() << endl;
-        std::cout << co.str();
-        return trie_builder();
+        // binary formula corpus.
+        formula_corpus_parser<formula_handler> parser(p, n, hdl);
+
+        try
+        {
+            parser.parse();
+        }
+        catch (const std::exception& e)
+        {
+            co << endl;
+            co << "  corpus parse error: " << e.what() << endl;
+            tc.counts = counts;
+            ++tc.counts.failed_files;
+            return trie_builder(m_build_mode);
+        }
+    }
+    else
+    {
+        orcus::xmlns_repository repo;
+        auto cxt = repo.create_context();
+        xml_handler xml_hdl(hdl);
+        // orcus only reads the labels.
+        orcus::tokens token_map(const_cast<const char**>(token_labels), ORCUS_N_ELEMENTS(token_labels));
+        orcus::sax_token_parser<xml_handler> parser(p, n, token_map, cxt, xml_hdl);
+
+        try
+        {
+            parser.parse();
+        }
+        catch (const std::exception& e)
+        {
+            co << endl;
+            co << "  XML parse error: " << e.what() << endl;
+            tc.counts = counts;
+            ++tc.counts.failed_files;
+            return trie_builder(m_build_mode);
+        }
     }
 
-    trie_builder trie;
+    trie_builder trie(m_build_mode);
     hdl.pop_trie(trie);
-    std::cout << co.str();
     return trie;
 }
 
+fs::path formula_xml_processor::get_contrib_path(const std::string& hash) const
+{
+    return m_contrib_dir / (hash + ".bin");
+}
+
+void formula_xml_processor::subtract_contribution(const std::string& filepath, const std::string& hash)
+{
+    std::ifstream ifs(get_contrib_path(hash).string(), std::ios::binary);
+    if (!ifs)
+    {
+        std::ostringstream os;
+        os << "contribution record for " << filepath << " is missing.";
+        throw std::runtime_error(os.str());
+    }
+
+    trie_builder old_trie;
+    old_trie.load(ifs);
+    m_trie.subtract(old_trie);
+}
+
+fs::path formula_xml_processor::get_run_dir() const
+{
+    return m_output_dir / "runs";
+}
+
+std::string formula_xml_processor::spill_run(trie_builder& trie) const
+{
+    std::ostringstream filename;
+    filename << "run-" << std::setw(6) << std::setfill('0') << m_next_run++ << ".map";
+    fs::path p = get_run_dir() / filename.str();
+
+    std::ofstream of(p.string(), std::ios::binary);
+    trie.write_flat(of);
+    of.close();
+
+    if (!of)
+        throw std::runtime_error("failed to write " + p.string());
+
+    trie_builder empty(m_build_mode);
+    trie.swap(empty);
+    return p.string();
+}
+
+void formula_xml_processor::merge_runs(const fs::path& path)
+{
+    // The runs get memory-mapped, so only the pages being merged need to be
+    // resident.
+    std::vector<std::unique_ptr<mapped_file>> files;
+    std::vector<flat_trie> runs;
+    std::vector<flat_trie_cursor> cursors;
+    runs.reserve(m_runs.size());
+    cursors.reserve(m_runs.size());
+
+    for (const std::string& run : m_runs)
+    {
+        files.push_back(std::make_unique<mapped_file>(run));
+        runs.emplace_back(files.back()->data(), files.back()->size());
+        cursors.emplace_back(runs.back());
+    }
+
+    size_t entry_count = 0;
+
+    write_atomically(path,
+        [&cursors, &entry_count](std::ostream& os)
+        {
+            flat_trie_writer writer(os);
+
+            kway_merge(cursors,
+                [&writer, &entry_count](const std::vector<uint16_t>& key, uint64_t count)
+                {
+                    if (count > std::numeric_limits<uint32_t>::max())
+                        throw std::runtime_error("merged count is too large.");
+
+                    writer.append(key.data(), key.size(), count);
+                    ++entry_count;
+                }
+            );
+
+            writer.finish();
+        }
+    );
+
+    m_run_entry_count = entry_count;
+
+    cursors.clear();
+    runs.clear();
+    files.clear();
+
+    for (const std::string& run : m_runs)
+        fs::remove(run);
+
+    m_runs.clear();
+}
+
 formula_xml_processor::formula_xml_processor(
     const fs::path& output_dir, const fs::path& debug_dir, bool verbose) :
     m_output_dir(output_dir),
     m_debug_dir(debug_dir),
-    m_verbose(verbose) {}
+    m_verbose(verbose),
+    m_start_time(std::chrono::steady_clock::now()) {}
 
 void formula_xml_processor::parse_files(const std::vector<std::string>& filepaths)
 {
-    size_t worker_count = std::thread::hardware_concurrency();
-    size_t data_size = filepaths.size() / worker_count;
+    using clock_type = std::chrono::steady_clock;
+    auto start_time = clock_type::now();
+    auto start_cpu = process_cpu_time();
 
-    // Split the data load evenly.
-    std::vector<path_pos_pair_type> filepaths_set(worker_count);
-    auto pos = filepaths.begin();
-    auto end = pos;
-    std::advance(end, data_size);
+    size_t worker_count = std::max<size_t>(1, std::thread::hardware_concurrency());
+    file_scheduler scheduler(filepaths, worker_count);
+    trie_reducer reducer;
+    std::vector<worker_stats> stats(worker_count);
 
-    for (size_t i = 0; i < worker_count - 1; ++i)
+    if (m_memory_limit)
     {
-        auto& set = filepaths_set[i];
-        set.first = pos;
-        set.second = end;
-        pos = end;
-        std::advance(end, data_size);
+        fs::create_directories(get_run_dir());
+
+        // Anything parsed previously gets merged with the runs too.
+        if (m_trie.size())
+            m_runs.push_back(spill_run(m_trie));
     }
+    else
+    {
+        // Anything parsed previously takes part in the reduction too.
+        reducer.reduce(std::move(m_trie));
+    }
+
+    // The worker threads only queue their debug records, and this writes
+    // them out.
+    std::unique_ptr<debug_trace_writer> trace_writer;
+    if (!m_debug_dir.empty())
+        trace_writer = std::make_unique<debug_trace_writer>();
 
-    end = filepaths.end();
-    filepaths_set.back().first = pos;
-    filepaths_set.back().second = end;
+    std::unique_ptr<file_prefetcher> prefetcher;
+    if (m_read_ahead)
+        prefetcher = std::make_unique<file_prefetcher>(filepaths, m_reader_count, m_read_ahead);
 
-    using future_type = std::future<trie_builder>;
+    using future_type = std::future<void>;
 
     std::vector<future_type> futures;
 
@@ -623,27 +1153,328 @@ void formula_xml_processor::parse_files(const std::vector<std::string>& filepath
     for (size_t i = 0; i < worker_count; ++i)
     {
         auto future = std::async(
-            std::launch::async, &formula_xml_processor::launch_worker_thread, this, filepaths_set[i]);
+            std::launch::async, &formula_xml_processor::launch_worker_thread, this,
+            std::ref(scheduler), prefetcher.get(), std::ref(reducer), i, std::ref(stats[i]), trace_writer.get());
 
         futures.push_back(std::move(future));
     }
 
-    // Wait on all worker threads.
+    // Wait on all worker threads.  Each worker merges its trie with those of
+    // the other workers before returning.
 
     for (future_type& future : futures)
+        future.get();
+
+    if (trace_writer)
+        trace_writer->stop();
+
+    if (m_memory_limit)
+    {
+        for (const worker_stats& ws : stats)
+            m_runs.insert(m_runs.end(), ws.runs.begin(), ws.runs.end());
+    }
+    else
+    {
+        trie_builder merged = reducer.release();
+        m_trie.swap(merged);
+    }
+
+    auto wall_time = clock_type::now() - start_time;
+
+    m_ingest_time.wall += wall_time;
+    m_ingest_time.cpu += process_cpu_time() - start_cpu;
+    m_worker_stats = stats;
+
+    if (m_memory_limit)
+        std::cout << "sorted runs: " << m_runs.size() << endl;
+    else
+        std::cout << "total entries: " << m_trie.size() << endl;
+
+    // Report how well the load was balanced.  Idle time is the portion of the
+    // whole run during which a worker was neither parsing nor merging.
+    auto to_sec = [](duration_type d) { return std::chrono::duration<double>(d).count(); };
+
+    std::cout << "worker time (wall: " << to_sec(wall_time) << " s):" << endl;
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        const worker_stats& ws = stats[i];
+        std::cout << "  - worker " << i << ": files: " << ws.file_count
+            << " (stolen: " << ws.stolen_count << ")"
+            << ", busy: " << to_sec(ws.busy_time) << " s"
+            << ", merge: " << to_sec(ws.merge_time) << " s"
+            << ", idle: " << to_sec(wall_time - ws.busy_time - ws.merge_time) << " s" << endl;
+    }
+}
+
+void formula_xml_processor::parse_files_incremental(const std::vector<std::string>& filepaths)
+{
+    fs::path trie_path = m_output_dir / "formula-tokens.bin";
+    fs::path manifest_path = m_output_dir / "formula-tokens.manifest";
+    m_contrib_dir = m_output_dir / "contributions";
+
+    phase_timer timer;
+
+    if (fs::exists(manifest_path))
     {
-        trie_builder trie = future.get();
-        m_trie.merge(trie);
+        std::ifstream ifs(manifest_path.string(), std::ios::binary);
+        m_manifest.load(ifs);
+
+        std::ifstream trie_ifs(trie_path.string(), std::ios::binary);
+        if (!trie_ifs)
+            throw std::runtime_error("formula-tokens.bin is missing from the output directory.");
+
+        m_trie.load(trie_ifs);
+    }
+    else if (fs::exists(trie_path))
+        throw std::runtime_error(
+            "formula-tokens.bin exists but was not written by an incremental run.  "
+            "Re-run without incremental mode or remove it.");
+
+    fs::create_directories(m_contrib_dir);
+
+    std::vector<std::string> to_parse;
+    std::unordered_set<std::string> given;
+    size_t changed_count = 0;
+    size_t unchanged_count = 0;
+
+    for (const std::string& filepath : filepaths)
+    {
+        // A file given more than once is only counted once.
+        if (!given.insert(filepath).second)
+            continue;
+
+        const file_manifest::entry* prev = m_manifest.find(filepath);
+        file_manifest::entry e = file_manifest::stat_file(filepath, prev);
+
+        if (prev && prev->hash == e.hash)
+        {
+            // Unchanged content.  Only the size or timestamp may need updating.
+            m_manifest.set(filepath, e);
+            ++unchanged_count;
+            continue;
+        }
+
+        if (prev)
+        {
+            subtract_contribution(filepath, prev->hash);
+            ++changed_count;
+        }
+
+        m_manifest.set(filepath, e);
+        to_parse.push_back(filepath);
+    }
+
+    // Files processed in a previous run but no longer given.
+    std::vector<std::string> removed;
+
+    for (const auto& entry : m_manifest.entries())
+    {
+        if (!given.count(entry.first))
+            removed.push_back(entry.first);
     }
 
-    std::cout << "total entries: " << m_trie.size() << endl;
+    for (const std::string& filepath : removed)
+    {
+        subtract_contribution(filepath, m_manifest.find(filepath)->hash);
+        m_manifest.remove(filepath);
+    }
+
+    std::cout << "files to parse: " << to_parse.size() << " (new: " << (to_parse.size() - changed_count)
+        << ", changed: " << changed_count << ", unchanged: " << unchanged_count
+        << ", removed: " << removed.size() << ")" << endl;
+
+    timer.lap(m_prepare_time);
+    parse_files(to_parse);
 }
 
 void formula_xml_processor::write_files()
 {
-    fs::path p = m_output_dir / "formula-tokens.bin";
-    std::ofstream of(p.string());
-    m_trie.write(of);
+    phase_timer timer;
+    phase_time pack_time, total_time;
+
+    if (m_memory_limit)
+    {
+        // The entries are only on disk, and get merged from the sorted runs
+        // straight into the flat layout.  A packed trie would need them all
+        // in memory.
+        fs::remove(m_output_dir / "formula-tokens.bin");
+        merge_runs(m_output_dir / "formula-tokens.map");
+
+        // Leave the directory in place if it has anything else in it.
+        boost::system::error_code ec;
+        fs::remove(get_run_dir(), ec);
+
+        timer.lap(pack_time);
+        m_pack_time += pack_time;
+
+        std::cout << "total entries: " << m_run_entry_count << endl;
+        return;
+    }
+
+    write_atomically(m_output_dir / "formula-tokens.bin",
+        [this, &pack_time](std::ostream& os) { m_trie.write(os, &pack_time); });
+
+    if (m_write_flat)
+    {
+        write_atomically(m_output_dir / "formula-tokens.map",
+            [this](std::ostream& os) { m_trie.write_flat(os); });
+    }
+    else
+        fs::remove(m_output_dir / "formula-tokens.map");
+
+    if (!m_contrib_dir.empty())
+        write_manifest();
+
+    timer.lap(total_time);
+
+    m_pack_time += pack_time;
+    m_write_time.wall += total_time.wall - pack_time.wall;
+    m_write_time.cpu += total_time.cpu - pack_time.cpu;
+}
+
+void formula_xml_processor::write_manifest() const
+{
+    write_atomically(m_output_dir / "formula-tokens.manifest",
+        [this](std::ostream& os) { m_manifest.save(os); });
+
+    // Remove the contribution records no longer referenced.
+    std::unordered_set<std::string> hashes;
+    for (const auto& entry : m_manifest.entries())
+        hashes.insert(entry.second.hash);
+
+    for (const fs::directory_entry& de : fs::directory_iterator(m_contrib_dir))
+    {
+        const fs::path& cp = de.path();
+        if (cp.extension() == ".bin" && !hashes.count(cp.stem().string()))
+            fs::remove(cp);
+    }
+}
+
+void formula_xml_processor::set_build_mode(trie_builder::build_mode mode)
+{
+    m_build_mode = mode;
+
+    // Carry over anything parsed so far.
+    trie_builder trie(mode);
+    trie.merge(m_trie);
+    m_trie.swap(trie);
+}
+
+void formula_xml_processor::set_memory_limit(size_t bytes)
+{
+    m_memory_limit = bytes;
+}
+
+void formula_xml_processor::set_write_flat(bool b)
+{
+    m_write_flat = b;
+}
+
+void formula_xml_processor::set_read_ahead(size_t bytes, size_t reader_count)
+{
+    m_read_ahead = bytes;
+    m_reader_count = std::max<size_t>(1, reader_count);
+}
+
+void formula_xml_processor::set_slowest_file_count(size_t n)
+{
+    m_slowest_file_count = n;
+}
+
+void formula_xml_processor::write_stats(std::ostream& os) const
+{
+    auto to_sec = [](duration_type d) { return std::chrono::duration<double>(d).count(); };
+
+    auto write_phase = [&os, &to_sec](const char* name, const phase_time& t, bool last = false)
+    {
+        os << "    \"" << name << "\": { \"wall-seconds\": " << to_sec(t.wall)
+           << ", \"cpu-seconds\": " << to_sec(t.cpu) << " }" << (last ? "\n" : ",\n");
+    };
+
+    // Aggregate the per-worker figures.
+    phase_time read, parse, local_merge, reduce, spill;
+    formula_counts counts;
+    size_t file_count = 0;
+    size_t bytes_read = 0;
+    std::vector<file_time> slowest;
+
+    for (const worker_stats& ws : m_worker_stats)
+    {
+        read += ws.read;
+        parse += ws.parse;
+        local_merge += ws.local_merge;
+        reduce += ws.reduce;
+        spill += ws.spill;
+        file_count += ws.file_count;
+        bytes_read += ws.bytes_read;
+
+        counts.accepted += ws.counts.accepted;
+        counts.tokens += ws.counts.tokens;
+        counts.invalid += ws.counts.invalid;
+        counts.undefined_name += ws.counts.undefined_name;
+        counts.error_token += ws.counts.error_token;
+        counts.cached += ws.counts.cached;
+        counts.failed_files += ws.counts.failed_files;
+
+        slowest.insert(slowest.end(), ws.slowest_files.begin(), ws.slowest_files.end());
+    }
+
+    std::sort(slowest.begin(), slowest.end(),
+        [](const file_time& l, const file_time& r) { return l.time > r.time; });
+
+    if (slowest.size() > m_slowest_file_count)
+        slowest.resize(m_slowest_file_count);
+
+    double ingest_sec = to_sec(m_ingest_time.wall);
+    auto per_sec = [ingest_sec](double v) { return ingest_sec > 0.0 ? v / ingest_sec : 0.0; };
+
+    os << "{\n";
+    os << "  \"wall-seconds\": " << to_sec(std::chrono::steady_clock::now() - m_start_time) << ",\n";
+    os << "  \"cpu-seconds\": " << to_sec(process_cpu_time()) << ",\n";
+    os << "  \"workers\": " << m_worker_stats.size() << ",\n";
+    os << "  \"build-mode\": \"" << (m_build_mode == trie_builder::build_mode::sort ? "sort" : "trie") << "\",\n";
+    os << "  \"files\": " << file_count << ",\n";
+    os << "  \"failed-files\": " << counts.failed_files << ",\n";
+    os << "  \"bytes-read\": " << bytes_read << ",\n";
+    os << "  \"formulas\": " << counts.accepted << ",\n";
+    os << "  \"tokens\": " << counts.tokens << ",\n";
+    os << "  \"repeated-formulas\": " << counts.cached << ",\n";
+    os << "  \"memory-limit\": " << m_memory_limit << ",\n";
+    os << "  \"read-ahead\": " << m_read_ahead << ",\n";
+    os << "  \"entries\": " << (m_memory_limit ? m_run_entry_count : m_trie.size()) << ",\n";
+    os << "  \"formulas-per-second\": " << per_sec(counts.accepted) << ",\n";
+    os << "  \"tokens-per-second\": " << per_sec(counts.tokens) << ",\n";
+    os << "  \"mb-per-second\": " << per_sec(bytes_read / 1.0e6) << ",\n";
+
+    // The times of the worker phases are summed over all worker threads.
+    os << "  \"phases\": {\n";
+    write_phase("prepare", m_prepare_time);
+    write_phase("ingest", m_ingest_time);
+    write_phase("read", read);
+    write_phase("parse", parse);
+    write_phase("merge", local_merge);
+    write_phase("reduce", reduce);
+    write_phase("spill", spill);
+    write_phase("pack", m_pack_time);
+    write_phase("write", m_write_time, true);
+    os << "  },\n";
+
+    os << "  \"rejected-formulas\": {\n";
+    os << "    \"invalid\": " << counts.invalid << ",\n";
+    os << "    \"undefined-name\": " << counts.undefined_name << ",\n";
+    os << "    \"error-token\": " << counts.error_token << "\n";
+    os << "  },\n";
+
+    os << "  \"slowest-files\": [";
+    for (size_t i = 0; i < slowest.size(); ++i)
+    {
+        const file_time& ft = slowest[i];
+        os << (i ? ",\n" : "\n") << "    { \"path\": ";
+        write_json_string(os, ft.filepath);
+        os << ", \"bytes\": " << ft.size << ", \"seconds\": " << to_sec(ft.time) << " }";
+    }
+    os << "\n  ]\n";
+    os << "}\n";
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
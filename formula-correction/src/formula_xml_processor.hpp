@@ -9,8 +9,18 @@
 
 #include "trie_builder.hpp"
 #include "async_queue.hpp"
+#include "debug_trace.hpp"
+#include "file_prefetcher.hpp"
+#include "file_scheduler.hpp"
+#include "file_manifest.hpp"
+#include "trie_reducer.hpp"
+#include "phase_timer.hpp"
 
 #include <boost/filesystem.hpp>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -18,22 +28,121 @@ class formula_xml_processor
 {
 public:
     using paths_type = std::vector<std::string>;
-    using path_pos_pair_type = std::pair<paths_type::const_iterator, paths_type::const_iterator>;
+    using duration_type = std::chrono::steady_clock::duration;
+
+    /**
+     * Numbers of formulas by outcome.  Each rejected formula is counted
+     * once, by the first reason found.
+     */
+    struct formula_counts
+    {
+        size_t accepted = 0;
+        size_t tokens = 0; // tokens of the accepted formulas.
+        size_t invalid = 0; // marked invalid in the input.
+        size_t undefined_name = 0;
+        size_t error_token = 0;
+        size_t cached = 0; // accepted formulas repeated within a document.
+        size_t failed_files = 0; // files that failed to parse.
+    };
 
     struct thread_context
     {
-        std::ofstream debug_output;
+        debug_trace_channel* trace = nullptr; // only set with a debug directory.
+        formula_counts counts;
+    };
+
+    struct file_time
+    {
+        std::string filepath;
+        size_t size;
+        duration_type time; // wall-clock time to read and parse.
+    };
+
+    struct worker_stats
+    {
+        size_t file_count = 0;
+        size_t stolen_count = 0;
+        size_t bytes_read = 0;
+        duration_type busy_time = duration_type::zero();
+        duration_type merge_time = duration_type::zero();
+        duration_type total_time = duration_type::zero();
+
+        phase_time read;
+        phase_time parse;
+        phase_time local_merge; // merging per-file tries into the worker trie.
+        phase_time reduce; // merging the worker tries.
+        phase_time spill; // writing sorted runs with a memory limit.
+
+        formula_counts counts;
+
+        /** sorted runs spilled to disk, in the flat trie layout. */
+        std::vector<std::string> runs;
+
+        /** min-heap of the slowest files by time. */
+        std::vector<file_time> slowest_files;
     };
 
 private:
     trie_builder m_trie;
+    file_manifest m_manifest;
     boost::filesystem::path m_output_dir;
     boost::filesystem::path m_debug_dir;
+    boost::filesystem::path m_contrib_dir; // only set in incremental mode.
     const bool m_verbose;
+    trie_builder::build_mode m_build_mode = trie_builder::build_mode::trie;
+    size_t m_memory_limit = 0; // in bytes, or 0 for no limit.
+    size_t m_read_ahead = 0; // byte budget of the reader threads, or 0 to read on the workers.
+    size_t m_reader_count = 2;
+    bool m_write_flat = false;
+    std::vector<std::string> m_runs; // sorted runs to merge when writing.
+    size_t m_run_entry_count = 0; // entries merged from the runs.
+    mutable std::atomic<size_t> m_next_run{0}; // shared by the worker threads.
+
+    // run statistics.
+    std::chrono::steady_clock::time_point m_start_time;
+    size_t m_slowest_file_count = 10;
+    std::vector<worker_stats> m_worker_stats;
+    phase_time m_prepare_time; // incremental mode set-up.
+    phase_time m_ingest_time;
+    phase_time m_pack_time;
+    phase_time m_write_time;
+
+    void launch_worker_thread(
+        file_scheduler& scheduler, file_prefetcher* prefetcher, trie_reducer& reducer, size_t worker,
+        worker_stats& stats, debug_trace_writer* trace_writer) const;
 
-    trie_builder launch_worker_thread(const path_pos_pair_type& filepaths) const;
+    trie_builder parse_file(const std::string& filepath, thread_context& tc, worker_stats& stats) const;
 
-    trie_builder parse_file(const std::string& filepath, thread_context& tc) const;
+    /**
+     * Parse the content of a file already in memory.
+     */
+    trie_builder parse_file(
+        const std::string& filepath, const char* p, size_t n, thread_context& tc, worker_stats& stats) const;
+
+    boost::filesystem::path get_contrib_path(const std::string& hash) const;
+
+    /**
+     * Subtract the counts that a file contributed in a previous run from
+     * the trie.
+     */
+    void subtract_contribution(const std::string& filepath, const std::string& hash);
+
+    boost::filesystem::path get_run_dir() const;
+
+    /**
+     * Write the entries of a trie to a new sorted run file, and empty the
+     * trie.
+     *
+     * @return path of the run file.
+     */
+    std::string spill_run(trie_builder& trie) const;
+
+    /**
+     * Merge the sorted runs into the flat output file, and remove them.
+     */
+    void merge_runs(const boost::filesystem::path& path);
+
+    void write_manifest() const;
 
 public:
 
@@ -46,7 +155,78 @@ public:
 
     void parse_files(const std::vector<std::string>& filepaths);
 
+    /**
+     * Load the formula-tokens.bin and the manifest written by a previous
+     * incremental run, and parse only those input files that are new or
+     * have changed since.  The old contributions of the changed files are
+     * subtracted first.  Files recorded in the manifest but not given as
+     * input are treated as removed: their contributions are subtracted, and
+     * they are dropped from the manifest.  A file given more than once is
+     * parsed once.
+     */
+    void parse_files_incremental(const std::vector<std::string>& filepaths);
+
     void write_files();
+
+    /**
+     * Set how the trie is built.  The sort mode does not support the
+     * incremental mode.
+     */
+    void set_build_mode(trie_builder::build_mode mode);
+
+    /**
+     * Limit the memory used for the formula data held by the worker
+     * threads.  Each worker gets an equal share of the limit, and writes its
+     * entries to disk as a sorted run whenever it exceeds its share.  The
+     * runs are merged into formula-tokens.map when writing, and no
+     * formula-tokens.bin gets written.  This does not support the
+     * incremental mode.
+     *
+     * @param bytes memory limit in bytes, or 0 for no limit.
+     */
+    void set_memory_limit(size_t bytes);
+
+    /**
+     * Also write the trie to formula-tokens.map in the flat layout, which
+     * can be memory-mapped and queried in place, but is many times the size
+     * of formula-tokens.bin.  Without it, a formula-tokens.map left by an
+     * earlier run is removed.  It is always written with a memory limit.
+     */
+    void set_write_flat(bool b);
+
+    /**
+     * Have the input files loaded into memory by dedicated reader threads
+     * ahead of the worker threads, rather than by the worker threads
+     * themselves.  The files are then handed to whichever worker is free
+     * next, instead of being scheduled by size.
+     *
+     * @param bytes maximum number of bytes of the files loaded ahead, or 0
+     *              to have the worker threads read the files.
+     * @param reader_count number of reader threads.
+     */
+    void set_read_ahead(size_t bytes, size_t reader_count);
+
+    /**
+     * Set the number of the slowest files to keep in the statistics.
+     */
+    void set_slowest_file_count(size_t n);
+
+    /**
+     * Write a JSON report of the time spent in each phase, the throughput,
+     * the rejected formulas and the slowest files.
+     */
+    void write_stats(std::ostream& os) const;
+
+    /**
+     * Parse formula data in either the XML or the binary corpus format that
+     * is already in memory.  Parse errors are reported to the console output
+     * buffer.
+     *
+     * @return trie containing the formulas of the data, or an empty trie on
+     *         parse error.
+     */
+    trie_builder parse_content(
+        const char* p, size_t n, thread_context& tc, std::ostringstream& co) const;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,72 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+/**
+ * Merge multiple sorted entry sequences into one, summing the values of the
+ * entries with equal keys.  Each cursor must provide valid(), key(),
+ * value() and next(), and must visit its entries in strictly ascending key
+ * order.
+ *
+ * @param cursors cursors to merge.  They are all exhausted on return.
+ * @param func function to call with the key and the summed value of each
+ *             merged entry, in ascending key order.
+ */
+template<typename CursorT, typename FuncT>
+void kway_merge(std::vector<CursorT>& cursors, FuncT func)
+{
+    // Min-heap of cursor positions ordered by their current keys.
+    auto greater = [&cursors](size_t left, size_t right)
+    {
+        return cursors[right].key() < cursors[left].key();
+    };
+
+    std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+
+    for (size_t i = 0; i < cursors.size(); ++i)
+    {
+        if (cursors[i].valid())
+            heap.push(i);
+    }
+
+    std::vector<size_t> matched;
+
+    while (!heap.empty())
+    {
+        size_t top = heap.top();
+        heap.pop();
+
+        uint64_t sum = cursors[top].value();
+        matched.assign(1, top);
+
+        while (!heap.empty() && cursors[heap.top()].key() == cursors[top].key())
+        {
+            size_t pos = heap.top();
+            heap.pop();
+            sum += cursors[pos].value();
+            matched.push_back(pos);
+        }
+
+        func(cursors[top].key(), sum);
+
+        for (size_t pos : matched)
+        {
+            cursors[pos].next();
+            if (cursors[pos].valid())
+                heap.push(pos);
+        }
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,92 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "mapped_file.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+[[noreturn]] void throw_errno(const char* what, const std::string& filepath)
+{
+    std::ostringstream os;
+    os << what << " " << filepath << ": " << std::strerror(errno);
+    throw std::runtime_error(os.str());
+}
+
+} // anonymous namespace
+
+mapped_file::mapped_file(const std::string& filepath, int flags)
+{
+    int fd = ::open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw_errno("failed to open", filepath);
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0)
+    {
+        ::close(fd);
+        throw_errno("failed to stat", filepath);
+    }
+
+    m_size = st.st_size;
+    if (!m_size)
+    {
+        ::close(fd);
+        return;
+    }
+
+    int map_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (flags & map_prefault)
+        map_flags |= MAP_POPULATE;
+#endif
+
+    void* p = ::mmap(nullptr, m_size, PROT_READ, map_flags, fd, 0);
+    ::close(fd); // the mapping stays valid.
+
+    if (p == MAP_FAILED)
+        throw_errno("failed to map", filepath);
+
+    m_data = static_cast<const char*>(p);
+
+#ifdef MADV_HUGEPAGE
+    if (flags & map_hugepages)
+        ::madvise(p, m_size, MADV_HUGEPAGE); // advisory only; ignore failures.
+#endif
+
+#ifndef MAP_POPULATE
+    if (flags & map_prefault)
+        ::madvise(p, m_size, MADV_WILLNEED);
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+    if (m_data)
+        ::munmap(const_cast<char*>(m_data), m_size);
+}
+
+const char* mapped_file::data() const
+{
+    return m_data;
+}
+
+size_t mapped_file::size() const
+{
+    return m_size;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
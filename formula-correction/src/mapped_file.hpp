@@ -0,0 +1,41 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Read-only memory mapping of a whole file.  The pages are shared with all
+ * other processes mapping the same file.
+ */
+class mapped_file
+{
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+
+public:
+    enum flags_type
+    {
+        map_default   = 0,
+        map_prefault  = 1 << 0, // populate the page tables up-front.
+        map_hugepages = 1 << 1, // advise the kernel to back the mapping with huge pages.
+    };
+
+    mapped_file(const std::string& filepath, int flags = map_default);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator= (const mapped_file&) = delete;
+
+    const char* data() const;
+
+    size_t size() const;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,74 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <future>
+#include <vector>
+
+/**
+ * Sort a random-access range using up to the specified number of threads.
+ * The range is split into one chunk per thread, the chunks are sorted
+ * concurrently, and then merged pairwise, also concurrently.
+ */
+template<typename IterT, typename CompT>
+void parallel_sort(IterT first, IterT last, CompT comp, size_t thread_count)
+{
+    size_t n = std::distance(first, last);
+
+    // Not worth the threads for small ranges.
+    constexpr size_t min_chunk_size = 1 << 14;
+    size_t chunk_count = std::max<size_t>(1, std::min(thread_count, n / min_chunk_size));
+
+    if (chunk_count == 1)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<IterT> bounds;
+    for (size_t i = 0; i < chunk_count; ++i)
+        bounds.push_back(first + n * i / chunk_count);
+    bounds.push_back(last);
+
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        futures.push_back(std::async(std::launch::async,
+            [&bounds, &comp, i]() { std::sort(bounds[i], bounds[i+1], comp); }));
+    }
+
+    for (auto& f : futures)
+        f.get();
+
+    // Merge adjacent chunk pairs until one chunk is left.
+    while (bounds.size() > 2)
+    {
+        futures.clear();
+        std::vector<IterT> merged_bounds;
+
+        for (size_t i = 0; i + 2 < bounds.size(); i += 2)
+        {
+            futures.push_back(std::async(std::launch::async,
+                [&bounds, &comp, i]() { std::inplace_merge(bounds[i], bounds[i+1], bounds[i+2], comp); }));
+            merged_bounds.push_back(bounds[i]);
+        }
+
+        // An odd chunk out is carried over to the next round as is.
+        if (bounds.size() % 2 == 0)
+            merged_bounds.push_back(bounds[bounds.size()-2]);
+        merged_bounds.push_back(bounds.back());
+
+        for (auto& f : futures)
+            f.get();
+
+        bounds.swap(merged_bounds);
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
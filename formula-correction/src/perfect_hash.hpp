@@ -0,0 +1,219 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Perfect hash maps from strings to values.  Each key gets a slot of its
+ * own, so that a lookup costs one hash of the string and one comparison
+ * with the key in its slot.  An empty slot holds an empty key and the null
+ * value, which is therefore also what a miss returns.
+ */
+namespace perfect_hash {
+
+/**
+ * FNV-1a over the bytes of a string, followed by a final mix.
+ */
+constexpr uint64_t hash(std::string_view s)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (char c : s)
+    {
+        h ^= uint8_t(c);
+        h *= 1099511628211ull;
+    }
+
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * Map a string hash to a slot for a seed.
+ */
+constexpr size_t slot(uint64_t h, uint64_t seed, size_t mask)
+{
+    uint64_t v = (h ^ (seed * 0x9E3779B97F4A7C15ull)) * 0xD6E8FEB86659FD93ull;
+    return (v >> 32) & mask;
+}
+
+constexpr size_t round_up_pow2(size_t n)
+{
+    size_t v = 1;
+    while (v < n)
+        v <<= 1;
+    return v;
+}
+
+template<typename ValueT>
+struct entry
+{
+    std::string_view key;
+    ValueT value;
+};
+
+/**
+ * Map whose keys are known at compile time.  All keys are placed with a
+ * single seed, searched for when the map is constructed, in a table four
+ * times as large as the number of keys.  Define it constexpr to have the
+ * search done by the compiler.
+ */
+template<typename ValueT, size_t N>
+class static_map
+{
+public:
+    using entry_type = entry<ValueT>;
+
+    static constexpr size_t slot_count = round_up_pow2(N * 4);
+
+private:
+    std::array<entry_type, slot_count> m_slots{};
+    uint64_t m_seed = 0;
+    ValueT m_null;
+
+public:
+    constexpr static_map(const entry_type (&entries)[N], ValueT null_value) : m_null(null_value)
+    {
+        for (uint64_t seed = 0; seed < (1u << 16); ++seed)
+        {
+            std::array<bool, slot_count> used{};
+            bool collided = false;
+
+            for (size_t i = 0; i < N && !collided; ++i)
+            {
+                size_t pos = slot(hash(entries[i].key), seed, slot_count - 1);
+                collided = used[pos];
+                used[pos] = true;
+            }
+
+            if (collided)
+                continue;
+
+            m_seed = seed;
+            for (auto& e : m_slots)
+                e = entry_type{std::string_view(), null_value};
+
+            for (size_t i = 0; i < N; ++i)
+                m_slots[slot(hash(entries[i].key), seed, slot_count - 1)] = entries[i];
+
+            return;
+        }
+
+        throw std::logic_error("perfect_hash::static_map: no seed places all keys.");
+    }
+
+    constexpr ValueT find(std::string_view key) const
+    {
+        const entry_type& e = m_slots[slot(hash(key), m_seed, slot_count - 1)];
+        return e.key == key ? e.value : m_null;
+    }
+};
+
+/**
+ * Map whose keys are only known at run time.  The keys are grouped into
+ * buckets by their hash, and each bucket gets its own seed that places
+ * all of its keys into free slots, starting with the largest buckets.
+ * The map owns copies of its keys.
+ */
+template<typename ValueT>
+class map
+{
+    struct slot_type
+    {
+        std::string key;
+        ValueT value;
+    };
+
+    std::vector<uint32_t> m_seeds; // one per bucket.
+    std::vector<slot_type> m_slots;
+    ValueT m_null;
+
+public:
+    /**
+     * @throw std::logic_error if the keys are not unique.
+     */
+    map(const std::vector<entry<ValueT>>& entries, ValueT null_value) :
+        m_seeds(round_up_pow2(std::max<size_t>(1, entries.size() / 2)), 0),
+        m_slots(round_up_pow2(std::max<size_t>(1, entries.size() * 2)), slot_type{std::string(), null_value}),
+        m_null(null_value)
+    {
+        const size_t bucket_mask = m_seeds.size() - 1;
+        const size_t slot_mask = m_slots.size() - 1;
+
+        std::vector<uint64_t> hashes;
+        std::vector<std::vector<size_t>> buckets(m_seeds.size());
+
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            hashes.push_back(hash(entries[i].key));
+            buckets[hashes.back() & bucket_mask].push_back(i);
+        }
+
+        std::vector<size_t> order(buckets.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+
+        std::stable_sort(order.begin(), order.end(),
+            [&buckets](size_t l, size_t r) { return buckets[l].size() > buckets[r].size(); });
+
+        std::vector<bool> used(m_slots.size(), false);
+        std::vector<size_t> positions;
+
+        for (size_t b : order)
+        {
+            const std::vector<size_t>& bucket = buckets[b];
+            if (bucket.empty())
+                break;
+
+            uint32_t seed = 0;
+            for (; seed < (1u << 20); ++seed)
+            {
+                positions.clear();
+                for (size_t i : bucket)
+                {
+                    size_t pos = slot(hashes[i], seed, slot_mask);
+                    if (used[pos] || std::find(positions.begin(), positions.end(), pos) != positions.end())
+                        break;
+                    positions.push_back(pos);
+                }
+
+                if (positions.size() == bucket.size())
+                    break;
+            }
+
+            if (positions.size() != bucket.size())
+                throw std::logic_error("perfect_hash::map: keys are not unique.");
+
+            m_seeds[b] = seed;
+            for (size_t i = 0; i < bucket.size(); ++i)
+            {
+                used[positions[i]] = true;
+                m_slots[positions[i]] = slot_type{std::string(entries[bucket[i]].key), entries[bucket[i]].value};
+            }
+        }
+    }
+
+    ValueT find(std::string_view key) const
+    {
+        uint64_t h = hash(key);
+        const slot_type& s = m_slots[slot(h, m_seeds[h & (m_seeds.size() - 1)], m_slots.size() - 1)];
+        return s.key == key ? s.value : m_null;
+    }
+};
+
+} // namespace perfect_hash
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
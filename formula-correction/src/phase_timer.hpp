@@ -0,0 +1,89 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <ctime>
+
+/**
+ * Wall-clock and CPU time spent in a processing phase.
+ */
+struct phase_time
+{
+    using duration_type = std::chrono::steady_clock::duration;
+
+    duration_type wall = duration_type::zero();
+    duration_type cpu = duration_type::zero();
+
+    phase_time& operator+= (const phase_time& r)
+    {
+        wall += r.wall;
+        cpu += r.cpu;
+        return *this;
+    }
+};
+
+/**
+ * @return CPU time consumed by the calling thread so far.
+ */
+inline phase_time::duration_type thread_cpu_time()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::duration_cast<phase_time::duration_type>(
+        std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec));
+}
+
+/**
+ * @return CPU time consumed by all threads of the process so far.
+ */
+inline phase_time::duration_type process_cpu_time()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return std::chrono::duration_cast<phase_time::duration_type>(
+        std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec));
+}
+
+/**
+ * Measures the wall-clock and CPU time of the calling thread between laps.
+ * It must be used on one thread only.
+ */
+class phase_timer
+{
+    using clock_type = std::chrono::steady_clock;
+
+    clock_type::time_point m_wall;
+    phase_time::duration_type m_cpu;
+
+public:
+    phase_timer() : m_wall(clock_type::now()), m_cpu(thread_cpu_time()) {}
+
+    /**
+     * Add the time elapsed since the construction or the previous lap to a
+     * phase, and start the next lap.
+     *
+     * @return time elapsed in this lap.
+     */
+    phase_time lap(phase_time& phase)
+    {
+        auto wall = clock_type::now();
+        auto cpu = thread_cpu_time();
+
+        phase_time elapsed;
+        elapsed.wall = wall - m_wall;
+        elapsed.cpu = cpu - m_cpu;
+        phase += elapsed;
+
+        m_wall = wall;
+        m_cpu = cpu;
+        return elapsed;
+    }
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
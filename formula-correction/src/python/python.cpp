@@ -5,10 +5,749 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#include "trie_loader.hpp"
+
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
 #define GETSTATE(m) ((struct module_state*)PyModule_GetState(m))
 
+namespace {
+
+using key_type = std::vector<uint16_t>;
+
+/**
+ * Convert a Python sequence of integers into a token sequence.
+ *
+ * @return true on success, false with a Python exception set on failure.
+ */
+bool to_tokens(PyObject* seq, key_type& tokens)
+{
+    PyObject* fast = PySequence_Fast(seq, "token sequence must be a sequence of integers.");
+    if (!fast)
+        return false;
+
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+    PyObject** items = PySequence_Fast_ITEMS(fast);
+
+    tokens.clear();
+    tokens.reserve(n);
+
+    for (Py_ssize_t i = 0; i < n; ++i)
+    {
+        long v = PyLong_AsLong(items[i]);
+        if (v == -1 && PyErr_Occurred())
+        {
+            Py_DECREF(fast);
+            return false;
+        }
+
+        if (v < 0 || v > std::numeric_limits<uint16_t>::max())
+        {
+            Py_DECREF(fast);
+            PyErr_SetString(PyExc_ValueError, "token value is out of range.");
+            return false;
+        }
+
+        tokens.push_back(v);
+    }
+
+    Py_DECREF(fast);
+    return true;
+}
+
+/**
+ * Run a query on a trie, catching the exception thrown when it reaches a
+ * corrupt node.  This does not touch any Python object, so it can run
+ * without the GIL.
+ *
+ * @return error message, or an empty string on success.
+ */
+template<typename FuncT>
+std::string try_query(FuncT func)
+{
+    try
+    {
+        func();
+    }
+    catch (const std::exception& e)
+    {
+        return e.what();
+    }
+
+    return std::string();
+}
+
+/**
+ * Set a Python exception from the error message of a query, if any.
+ *
+ * @return true if the query failed.
+ */
+bool set_query_error(const std::string& error)
+{
+    if (error.empty())
+        return false;
+
+    PyErr_SetString(PyExc_IOError, error.c_str());
+    return true;
+}
+
+PyObject* to_tuple(const key_type& tokens)
+{
+    PyObject* t = PyTuple_New(tokens.size());
+    if (!t)
+        return nullptr;
+
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        PyObject* v = PyLong_FromLong(tokens[i]);
+        if (!v)
+        {
+            Py_DECREF(t);
+            return nullptr;
+        }
+
+        PyTuple_SET_ITEM(t, i, v);
+    }
+
+    return t;
+}
+
+// ----------------------------------------------------------------------------
+// Buffer: read-only, one-dimensional array exposed via the buffer protocol.
+
+struct pyobj_buffer
+{
+    PyObject_HEAD
+
+    void* storage;
+    void (*free_storage)(void*);
+    const void* data;
+    const char* format;
+    Py_ssize_t itemsize;
+    Py_ssize_t shape[1];
+};
+
+PyTypeObject buffer_type = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+void buffer_dealloc(PyObject* self)
+{
+    pyobj_buffer* obj = reinterpret_cast<pyobj_buffer*>(self);
+    if (obj->storage)
+        obj->free_storage(obj->storage);
+
+    Py_TYPE(self)->tp_free(self);
+}
+
+int buffer_getbuffer(PyObject* self, Py_buffer* view, int flags)
+{
+    pyobj_buffer* obj = reinterpret_cast<pyobj_buffer*>(self);
+
+    if (flags & PyBUF_WRITABLE)
+    {
+        PyErr_SetString(PyExc_BufferError, "buffer is read-only.");
+        view->obj = nullptr;
+        return -1;
+    }
+
+    view->obj = self;
+    Py_INCREF(self);
+    view->buf = const_cast<void*>(obj->data);
+    view->len = obj->shape[0] * obj->itemsize;
+    view->readonly = 1;
+    view->itemsize = obj->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(obj->format) : nullptr;
+    view->ndim = 1;
+    view->shape = (flags & PyBUF_ND) ? obj->shape : nullptr;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &obj->itemsize : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    return 0;
+}
+
+Py_ssize_t buffer_length(PyObject* self)
+{
+    return reinterpret_cast<pyobj_buffer*>(self)->shape[0];
+}
+
+PyBufferProcs buffer_as_buffer = { buffer_getbuffer, nullptr };
+
+PySequenceMethods buffer_as_sequence = { buffer_length };
+
+template<typename T> const char* buffer_format();
+template<> const char* buffer_format<uint16_t>() { return "H"; }
+template<> const char* buffer_format<uint32_t>() { return "I"; }
+template<> const char* buffer_format<uint64_t>() { return "Q"; }
+
+/**
+ * Create a buffer object that takes over the content of a vector.
+ */
+template<typename T>
+PyObject* create_buffer(std::vector<T>&& values)
+{
+    pyobj_buffer* obj = PyObject_New(pyobj_buffer, &buffer_type);
+    if (!obj)
+        return nullptr;
+
+    auto* storage = new std::vector<T>(std::move(values));
+    obj->storage = storage;
+    obj->free_storage = [](void* p) { delete static_cast<std::vector<T>*>(p); };
+    obj->data = storage->data();
+    obj->format = buffer_format<T>();
+    obj->itemsize = sizeof(T);
+    obj->shape[0] = storage->size();
+
+    return reinterpret_cast<PyObject*>(obj);
+}
+
+// ----------------------------------------------------------------------------
+// FormulaTrie
+
+struct pyobj_formula_trie
+{
+    PyObject_HEAD
+
+    trie_loader* loader;
+};
+
+PyTypeObject formula_trie_type = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+struct pyobj_prefix_iter
+{
+    PyObject_HEAD
+
+    PyObject* trie; // keeps the trie alive while iterating.
+    flat_trie_cursor* cursor;
+};
+
+PyTypeObject prefix_iter_type = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+const flat_trie* get_trie(PyObject* self)
+{
+    pyobj_formula_trie* obj = reinterpret_cast<pyobj_formula_trie*>(self);
+    if (!obj->loader)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "formula trie is not initialized.");
+        return nullptr;
+    }
+
+    return &obj->loader->get();
+}
+
+void formula_trie_dealloc(PyObject* self)
+{
+    delete reinterpret_cast<pyobj_formula_trie*>(self)->loader;
+    Py_TYPE(self)->tp_free(self);
+}
+
+PyObject* formula_trie_new(PyTypeObject* type, PyObject* /*args*/, PyObject* /*kwargs*/)
+{
+    pyobj_formula_trie* self = reinterpret_cast<pyobj_formula_trie*>(type->tp_alloc(type, 0));
+    if (self)
+        self->loader = nullptr;
+
+    return reinterpret_cast<PyObject*>(self);
+}
+
+int formula_trie_init(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    static const char* kwlist[] = { "path", "prefault", nullptr };
+
+    const char* path = nullptr;
+    int prefault = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|p", const_cast<char**>(kwlist), &path, &prefault))
+        return -1;
+
+    // The prefix iterators and the queries running without the GIL use the
+    // loader, so it can never be replaced.
+    pyobj_formula_trie* obj = reinterpret_cast<pyobj_formula_trie*>(self);
+    if (obj->loader)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "formula trie is already initialized.");
+        return -1;
+    }
+
+    auto loader = std::make_unique<trie_loader>();
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        loader->load(path, prefault ? mapped_file::map_prefault : mapped_file::map_default);
+    }
+    catch (const std::exception& e)
+    {
+        error = e.what();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty())
+    {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+        return -1;
+    }
+
+    // Another thread may have initialized it while the GIL was released.
+    if (obj->loader)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "formula trie is already initialized.");
+        return -1;
+    }
+
+    obj->loader = loader.release();
+    return 0;
+}
+
+Py_ssize_t formula_trie_length(PyObject* self)
+{
+    const flat_trie* trie = get_trie(self);
+    return trie ? trie->size() : -1;
+}
+
+int formula_trie_contains(PyObject* self, PyObject* key)
+{
+    const flat_trie* trie = get_trie(self);
+    if (!trie)
+        return -1;
+
+    key_type tokens;
+    if (!to_tokens(key, tokens))
+        return -1;
+
+    uint32_t count = 0;
+    if (set_query_error(try_query([&]() { count = trie->find(tokens.data(), tokens.size()); })))
+        return -1;
+
+    return count ? 1 : 0;
+}
+
+PyObject* formula_trie_get(PyObject* self, PyObject* arg)
+{
+    const flat_trie* trie = get_trie(self);
+    if (!trie)
+        return nullptr;
+
+    key_type tokens;
+    if (!to_tokens(arg, tokens))
+        return nullptr;
+
+    uint32_t count = 0;
+    if (set_query_error(try_query([&]() { count = trie->find(tokens.data(), tokens.size()); })))
+        return nullptr;
+
+    return PyLong_FromUnsignedLong(count);
+}
+
+PyObject* formula_trie_get_many(PyObject* self, PyObject* arg)
+{
+    const flat_trie* trie = get_trie(self);
+    if (!trie)
+        return nullptr;
+
+    PyObject* fast = PySequence_Fast(arg, "argument must be a sequence of token sequences.");
+    if (!fast)
+        return nullptr;
+
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(fast);
+    PyObject** items = PySequence_Fast_ITEMS(fast);
+
+    // Flatten all keys into one buffer before releasing the GIL.
+    key_type tokens;
+    key_type key;
+    std::vector<size_t> offsets(1, 0);
+    offsets.reserve(n + 1);
+
+    for (Py_ssize_t i = 0; i < n; ++i)
+    {
+        if (!to_tokens(items[i], key))
+        {
+            Py_DECREF(fast);
+            return nullptr;
+        }
+
+        tokens.insert(tokens.end(), key.begin(), key.end());
+        offsets.push_back(tokens.size());
+    }
+
+    Py_DECREF(fast);
+
+    std::vector<uint32_t> counts(n);
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+    error = try_query([&]()
+        {
+            for (Py_ssize_t i = 0; i < n; ++i)
+                counts[i] = trie->find(tokens.data() + offsets[i], offsets[i+1] - offsets[i]);
+        }
+    );
+    Py_END_ALLOW_THREADS
+
+    if (set_query_error(error))
+        return nullptr;
+
+    return create_buffer(std::move(counts));
+}
+
+PyObject* formula_trie_prefix(PyObject* self, PyObject* args)
+{
+    const flat_trie* trie = get_trie(self);
+    if (!trie)
+        return nullptr;
+
+    PyObject* prefix_obj = nullptr;
+    if (!PyArg_ParseTuple(args, "|O", &prefix_obj))
+        return nullptr;
+
+    key_type prefix;
+    if (prefix_obj && !to_tokens(prefix_obj, prefix))
+        return nullptr;
+
+    std::unique_ptr<flat_trie_cursor> cursor;
+    if (set_query_error(try_query(
+        [&]() { cursor = std::make_unique<flat_trie_cursor>(*trie, prefix.data(), prefix.size()); })))
+        return nullptr;
+
+    pyobj_prefix_iter* it = PyObject_New(pyobj_prefix_iter, &prefix_iter_type);
+    if (!it)
+        return nullptr;
+
+    Py_INCREF(self);
+    it->trie = self;
+    it->cursor = cursor.release();
+
+    return reinterpret_cast<PyObject*>(it);
+}
+
+PyObject* formula_trie_top_k(PyObject* self, PyObject* args)
+{
+    const flat_trie* trie = get_trie(self);
+    if (!trie)
+        return nullptr;
+
+    PyObject* prefix_obj = nullptr;
+    Py_ssize_t k = 10;
+    if (!PyArg_ParseTuple(args, "O|n", &prefix_obj, &k))
+        return nullptr;
+
+    if (k < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "k must not be negative.");
+        return nullptr;
+    }
+
+    key_type prefix;
+    if (!to_tokens(prefix_obj, prefix))
+        return nullptr;
+
+    std::vector<flat_trie::entry> entries;
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+    error = try_query([&]() { entries = trie->top_k(prefix.data(), prefix.size(), k); });
+    Py_END_ALLOW_THREADS
+
+    if (set_query_error(error))
+        return nullptr;
+
+    PyObject* ret = PyList_New(entries.size());
+    if (!ret)
+        return nullptr;
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        PyObject* key = to_tuple(entries[i].key);
+        PyObject* item = key ? Py_BuildValue("(NK)", key, static_cast<unsigned long long>(entries[i].value)) : nullptr;
+        if (!item)
+        {
+            Py_DECREF(ret);
+            return nullptr;
+        }
+
+        PyList_SET_ITEM(ret, i, item);
+    }
+
+    return ret;
+}
+
+PyObject* formula_trie_nearest(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    static const char* kwlist[] = { "tokens", "max_distance", "k", nullptr };
+
+    const flat_trie* trie = get_trie(self);
+    if (!trie)
+        return nullptr;
+
+    PyObject* tokens_obj = nullptr;
+    Py_ssize_t max_distance = 2;
+    Py_ssize_t k = 10;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|nn", const_cast<char**>(kwlist), &tokens_obj, &max_distance, &k))
+        return nullptr;
+
+    if (max_distance < 0 || k < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "max_distance and k must not be negative.");
+        return nullptr;
+    }
+
+    key_type tokens;
+    if (!to_tokens(tokens_obj, tokens))
+        return nullptr;
+
+    std::vector<flat_trie::match> matches;
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+    error = try_query([&]() { matches = trie->find_nearest(tokens.data(), tokens.size(), max_distance, k); });
+    Py_END_ALLOW_THREADS
+
+    if (set_query_error(error))
+        return nullptr;
+
+    PyObject* ret = PyList_New(matches.size());
+    if (!ret)
+        return nullptr;
+
+    for (size_t i = 0; i < matches.size(); ++i)
+    {
+        const flat_trie::match& m = matches[i];
+        PyObject* key = to_tuple(m.key);
+        PyObject* item = key ? Py_BuildValue(
+            "(NKn)", key, static_cast<unsigned long long>(m.value), static_cast<Py_ssize_t>(m.distance)) : nullptr;
+
+        if (!item)
+        {
+            Py_DECREF(ret);
+            return nullptr;
+        }
+
+        PyList_SET_ITEM(ret, i, item);
+    }
+
+    return ret;
+}
+
+PyObject* formula_trie_export(PyObject* self, PyObject* args, PyObject* kwargs)
+{
+    const flat_trie* trie = get_trie(self);
+    if (!trie)
+        return nullptr;
+
+    static const char* kwlist[] = { "prefix", "vocab", nullptr };
+
+    PyObject* prefix_obj = nullptr;
+    const char* vocab_path = nullptr;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Oz", const_cast<char**>(kwlist), &prefix_obj, &vocab_path))
+        return nullptr;
+
+    key_type prefix;
+    if (prefix_obj && prefix_obj != Py_None && !to_tokens(prefix_obj, prefix))
+        return nullptr;
+
+    std::vector<uint16_t> tokens;
+    std::vector<uint64_t> offsets(1, 0);
+    std::vector<uint32_t> counts;
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        trie->for_each_prefix(prefix.data(), prefix.size(),
+            [&](const key_type& key, uint32_t count)
+            {
+                tokens.insert(tokens.end(), key.begin(), key.end());
+                offsets.push_back(tokens.size());
+                counts.push_back(count);
+            }
+        );
+
+        if (vocab_path)
+        {
+            std::ifstream ifs(vocab_path);
+            if (!ifs)
+                throw std::runtime_error(std::string("failed to open ") + vocab_path);
+
+            token_vocab vocab;
+            vocab.load(ifs);
+            vocab.remap(tokens.data(), tokens.size(), tokens.data());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        error = e.what();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty())
+    {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+        return nullptr;
+    }
+
+    PyObject* tokens_buf = create_buffer(std::move(tokens));
+    PyObject* offsets_buf = create_buffer(std::move(offsets));
+    PyObject* counts_buf = create_buffer(std::move(counts));
+
+    if (!tokens_buf || !offsets_buf || !counts_buf)
+    {
+        Py_XDECREF(tokens_buf);
+        Py_XDECREF(offsets_buf);
+        Py_XDECREF(counts_buf);
+        return nullptr;
+    }
+
+    return Py_BuildValue("(NNN)", tokens_buf, offsets_buf, counts_buf);
+}
+
+PyObject* formula_trie_build_vocab(PyObject* self, PyObject* args)
+{
+    const flat_trie* trie = get_trie(self);
+    if (!trie)
+        return nullptr;
+
+    const char* path = nullptr;
+    if (!PyArg_ParseTuple(args, "s", &path))
+        return nullptr;
+
+    size_t vocab_size = 0;
+    std::string error;
+
+    Py_BEGIN_ALLOW_THREADS
+    try
+    {
+        token_vocab vocab = token_vocab::build(*trie, std::max(1u, std::thread::hardware_concurrency()));
+        vocab_size = vocab.size() - 1;
+
+        std::ofstream of(path);
+        vocab.save(of);
+        of.close();
+
+        if (!of)
+            throw std::runtime_error(std::string("failed to write ") + path);
+    }
+    catch (const std::exception& e)
+    {
+        error = e.what();
+    }
+    Py_END_ALLOW_THREADS
+
+    if (!error.empty())
+    {
+        PyErr_SetString(PyExc_IOError, error.c_str());
+        return nullptr;
+    }
+
+    return PyLong_FromSize_t(vocab_size);
+}
+
+PyMethodDef formula_trie_methods[] =
+{
+    { "get", formula_trie_get, METH_O,
+      "Return the count of a token sequence, or 0 if the sequence is not in the trie." },
+    { "get_many", formula_trie_get_many, METH_O,
+      "Return the counts of multiple token sequences as an array of uint32." },
+    { "prefix", formula_trie_prefix, METH_VARARGS,
+      "Iterate over the (tokens, count) pairs whose tokens start with the specified prefix." },
+    { "top_k", formula_trie_top_k, METH_VARARGS,
+      "Return up to k (tokens, count) pairs whose tokens start with the specified prefix, "
+      "in descending order of their counts." },
+    { "nearest", reinterpret_cast<PyCFunction>(formula_trie_nearest), METH_VARARGS | METH_KEYWORDS,
+      "nearest(tokens, max_distance=2, k=10)\n\n"
+      "Return up to k (tokens, count, distance) tuples within the token-level edit distance of "
+      "the specified tokens, sorted by ascending distance, then by descending count." },
+    { "export", reinterpret_cast<PyCFunction>(formula_trie_export), METH_VARARGS | METH_KEYWORDS,
+      "export(prefix=None, vocab=None)\n\n"
+      "Export all entries, or those starting with the specified prefix, as a tuple of three "
+      "arrays: the concatenated tokens (uint16), the offsets of each entry into the tokens "
+      "(uint64, one more than the number of entries), and the counts (uint32).  If a "
+      "vocabulary file is specified, the tokens are remapped to its dense identifiers." },
+    { "build_vocab", formula_trie_build_vocab, METH_VARARGS,
+      "build_vocab(path)\n\n"
+      "Build a vocabulary that gives each token in the trie a dense identifier in descending "
+      "order of frequency, starting at 1, and write it to the specified file.  Return the "
+      "number of tokens in the vocabulary." },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+PySequenceMethods formula_trie_as_sequence = {};
+
+void prefix_iter_dealloc(PyObject* self)
+{
+    pyobj_prefix_iter* it = reinterpret_cast<pyobj_prefix_iter*>(self);
+    delete it->cursor;
+    Py_XDECREF(it->trie);
+    Py_TYPE(self)->tp_free(self);
+}
+
+PyObject* prefix_iter_next(PyObject* self)
+{
+    pyobj_prefix_iter* it = reinterpret_cast<pyobj_prefix_iter*>(self);
+    flat_trie_cursor& cursor = *it->cursor;
+
+    if (!cursor.valid())
+        return nullptr; // StopIteration
+
+    PyObject* key = to_tuple(cursor.key());
+    if (!key)
+        return nullptr;
+
+    PyObject* ret = Py_BuildValue("(NK)", key, static_cast<unsigned long long>(cursor.value()));
+    if (set_query_error(try_query([&cursor]() { cursor.next(); })))
+    {
+        Py_XDECREF(ret);
+        return nullptr;
+    }
+
+    return ret;
+}
+
+bool init_types()
+{
+    buffer_type.tp_name = "_orcus_ml_formula_correction.Buffer";
+    buffer_type.tp_basicsize = sizeof(pyobj_buffer);
+    buffer_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    buffer_type.tp_doc = "Read-only array exposed via the buffer protocol.";
+    buffer_type.tp_dealloc = buffer_dealloc;
+    buffer_type.tp_as_buffer = &buffer_as_buffer;
+    buffer_type.tp_as_sequence = &buffer_as_sequence;
+
+    formula_trie_as_sequence.sq_length = formula_trie_length;
+    formula_trie_as_sequence.sq_contains = formula_trie_contains;
+
+    formula_trie_type.tp_name = "_orcus_ml_formula_correction.FormulaTrie";
+    formula_trie_type.tp_basicsize = sizeof(pyobj_formula_trie);
+    formula_trie_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    formula_trie_type.tp_doc =
+        "FormulaTrie(path, prefault=False)\n\n"
+        "Formula token trie loaded from a formula-tokens.map or formula-tokens.bin file.";
+    formula_trie_type.tp_new = formula_trie_new;
+    formula_trie_type.tp_init = formula_trie_init;
+    formula_trie_type.tp_dealloc = formula_trie_dealloc;
+    formula_trie_type.tp_methods = formula_trie_methods;
+    formula_trie_type.tp_as_sequence = &formula_trie_as_sequence;
+
+    prefix_iter_type.tp_name = "_orcus_ml_formula_correction.PrefixIterator";
+    prefix_iter_type.tp_basicsize = sizeof(pyobj_prefix_iter);
+    prefix_iter_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    prefix_iter_type.tp_dealloc = prefix_iter_dealloc;
+    prefix_iter_type.tp_iter = PyObject_SelfIter;
+    prefix_iter_type.tp_iternext = prefix_iter_next;
+
+    return PyType_Ready(&buffer_type) == 0 &&
+        PyType_Ready(&formula_trie_type) == 0 &&
+        PyType_Ready(&prefix_iter_type) == 0;
+}
+
+} // anonymous namespace
+
 PyMethodDef module_methods[] =
 {
     { nullptr, nullptr, 0, nullptr }
@@ -48,7 +787,20 @@ extern "C" {
 
 PyObject* PyInit__orcus_ml_formula_correction()
 {
+    if (!init_types())
+        return nullptr;
+
     PyObject* m = PyModule_Create(&moduledef);
+    if (!m)
+        return nullptr;
+
+    Py_INCREF(&formula_trie_type);
+    if (PyModule_AddObject(m, "FormulaTrie", reinterpret_cast<PyObject*>(&formula_trie_type)) < 0)
+    {
+        Py_DECREF(&formula_trie_type);
+        Py_DECREF(m);
+        return nullptr;
+    }
 
     return m;
 }
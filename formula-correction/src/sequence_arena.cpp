@@ -0,0 +1,174 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "sequence_arena.hpp"
+#include "parallel_sort.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+sequence_arena::sequence_arena() {}
+
+sequence_arena::sequence_arena(sequence_arena&& other) :
+    m_tokens(std::move(other.m_tokens)),
+    m_entries(std::move(other.m_entries)),
+    m_slots(std::move(other.m_slots)),
+    m_sorted(other.m_sorted) {}
+
+sequence_arena& sequence_arena::operator= (sequence_arena&& other)
+{
+    sequence_arena tmp(std::move(other));
+    swap(tmp);
+    return *this;
+}
+
+uint64_t sequence_arena::hash(const uint16_t* p, size_t n)
+{
+    constexpr uint64_t k = 0x9E3779B97F4A7C15ull;
+    uint64_t h = n * k;
+
+    // Four tokens at a time.
+    for (; n >= 4; p += 4, n -= 4)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        h = (h ^ v) * k;
+        h ^= h >> 29;
+    }
+
+    for (; n; ++p, --n)
+    {
+        h = (h ^ *p) * k;
+        h ^= h >> 29;
+    }
+
+    h ^= h >> 32;
+    return h;
+}
+
+bool sequence_arena::equals(const entry& e, const uint16_t* p, size_t n) const
+{
+    return e.length == n && std::equal(p, p + n, m_tokens.data() + e.offset);
+}
+
+void sequence_arena::rehash(size_t slot_count)
+{
+    std::vector<uint32_t> slots(slot_count, 0);
+    const size_t mask = slot_count - 1;
+
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+        const entry& e = m_entries[i];
+        size_t pos = hash(data(e), e.length) & mask;
+        while (slots[pos])
+            pos = (pos + 1) & mask;
+
+        slots[pos] = i + 1;
+    }
+
+    m_slots.swap(slots);
+}
+
+void sequence_arena::insert(const uint16_t* p, size_t n, uint32_t count)
+{
+    if (!n)
+        return;
+
+    if (m_slots.empty())
+        rehash(1024);
+
+    const size_t mask = m_slots.size() - 1;
+    size_t pos = hash(p, n) & mask;
+
+    for (; m_slots[pos]; pos = (pos + 1) & mask)
+    {
+        entry& e = m_entries[m_slots[pos] - 1];
+        if (equals(e, p, n))
+        {
+            e.count += count;
+            return;
+        }
+    }
+
+    if (m_entries.size() >= std::numeric_limits<uint32_t>::max() - 1)
+        throw std::runtime_error("sequence_arena: too many sequences.");
+
+    m_entries.push_back({m_tokens.size(), uint32_t(n), count});
+    m_tokens.insert(m_tokens.end(), p, p + n);
+    m_slots[pos] = m_entries.size();
+    m_sorted = false;
+
+    // Keep the load factor at or below one half.
+    if (m_entries.size() * 2 > m_slots.size())
+        rehash(m_slots.size() * 2);
+}
+
+void sequence_arena::merge(const sequence_arena& other)
+{
+    for (const entry& e : other.m_entries)
+        insert(other.data(e), e.length, e.count);
+}
+
+size_t sequence_arena::size() const
+{
+    return m_entries.size();
+}
+
+size_t sequence_arena::memory_size() const
+{
+    return m_tokens.capacity() * sizeof(uint16_t) + m_entries.capacity() * sizeof(entry) +
+        m_slots.capacity() * sizeof(uint32_t);
+}
+
+void sequence_arena::sort(size_t thread_count)
+{
+    if (m_sorted)
+        return;
+
+    parallel_sort(m_entries.begin(), m_entries.end(),
+        [this](const entry& l, const entry& r) { return less(l, r); }, thread_count);
+
+    // The slots refer to the entries by their positions.
+    if (!m_slots.empty())
+        rehash(m_slots.size());
+
+    m_sorted = true;
+}
+
+bool sequence_arena::sorted() const
+{
+    return m_sorted;
+}
+
+const std::vector<sequence_arena::entry>& sequence_arena::entries() const
+{
+    return m_entries;
+}
+
+const uint16_t* sequence_arena::data(const entry& e) const
+{
+    return m_tokens.data() + e.offset;
+}
+
+bool sequence_arena::less(const entry& l, const entry& r) const
+{
+    const uint16_t* lp = data(l);
+    const uint16_t* rp = data(r);
+    return std::lexicographical_compare(lp, lp + l.length, rp, rp + r.length);
+}
+
+void sequence_arena::swap(sequence_arena& other)
+{
+    m_tokens.swap(other.m_tokens);
+    m_entries.swap(other.m_entries);
+    m_slots.swap(other.m_slots);
+    std::swap(m_sorted, other.m_sorted);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,88 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Counts distinct token sequences.  The sequences are stored back to back
+ * in one contiguous buffer, and duplicates are detected through an
+ * open-addressing hash table, so that an insertion costs one hash lookup
+ * and no allocation beyond the occasional growth of the buffers.
+ */
+class sequence_arena
+{
+public:
+    struct entry
+    {
+        uint64_t offset; // position of the first token in the buffer.
+        uint32_t length;
+        uint32_t count;
+    };
+
+private:
+    std::vector<uint16_t> m_tokens;
+    std::vector<entry> m_entries;
+    std::vector<uint32_t> m_slots; // entry position + 1, or 0 if empty.
+    bool m_sorted = false;
+
+    static uint64_t hash(const uint16_t* p, size_t n);
+
+    bool equals(const entry& e, const uint16_t* p, size_t n) const;
+
+    void rehash(size_t slot_count);
+
+public:
+    sequence_arena();
+    sequence_arena(sequence_arena&& other);
+
+    sequence_arena& operator= (sequence_arena&& other);
+
+    /**
+     * Add a sequence, or add to its count if it is already present.
+     */
+    void insert(const uint16_t* p, size_t n, uint32_t count = 1);
+
+    /**
+     * Add all sequences of another arena with their counts.
+     */
+    void merge(const sequence_arena& other);
+
+    size_t size() const;
+
+    /**
+     * @return number of bytes allocated for the sequences, the entries and
+     *         the hash table.
+     */
+    size_t memory_size() const;
+
+    /**
+     * Sort the entries in ascending order of their sequences, using up to
+     * the specified number of threads.  The arena remains usable for
+     * further insertions.
+     */
+    void sort(size_t thread_count);
+
+    bool sorted() const;
+
+    const std::vector<entry>& entries() const;
+
+    const uint16_t* data(const entry& e) const;
+
+    /**
+     * @return true if the sequence of the left entry is less than that of
+     *         the right entry.
+     */
+    bool less(const entry& l, const entry& r) const;
+
+    void swap(sequence_arena& other);
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
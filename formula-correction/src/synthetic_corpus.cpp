@@ -0,0 +1,432 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "synthetic_corpus.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
+namespace {
+
+// Default function mix, roughly following the frequencies in real documents.
+const std::vector<std::pair<std::string, double>> default_functions = {
+    { "SUM",         30.0 },
+    { "IF",          15.0 },
+    { "VLOOKUP",      8.0 },
+    { "AVERAGE",      6.0 },
+    { "ROUND",        6.0 },
+    { "MAX",          4.0 },
+    { "MIN",          4.0 },
+    { "COUNT",        3.0 },
+    { "INDEX",        3.0 },
+    { "SUMIF",        3.0 },
+    { "AND",          2.0 },
+    { "OR",           2.0 },
+    { "CONCATENATE",  2.0 },
+    { "COUNTA",       2.0 },
+    { "LEN",          1.0 },
+    { "LEFT",         1.0 },
+    { "RIGHT",        1.0 },
+    { "ABS",          1.0 },
+    { "NOW",          1.0 },
+};
+
+const char* errors[] = { "Err:501", "Err:502", "Err:508", "Err:509", "Err:511" };
+
+const std::string undefined_name = "UndefinedName";
+
+struct binary_op
+{
+    const char* op;
+    const char* symbol;
+};
+
+const binary_op binary_ops[] = {
+    { "plus",     "+" },
+    { "minus",    "-" },
+    { "multiply", "*" },
+    { "divide",   "/" },
+    { "concat",   "&" },
+    { "equal",    "=" },
+    { "less",     "<" },
+    { "greater",  ">" },
+};
+
+void append_escaped(std::string& buf, const std::string& s)
+{
+    for (char c : s)
+    {
+        switch (c)
+        {
+            case '&':
+                buf += "&amp;";
+                break;
+            case '<':
+                buf += "&lt;";
+                break;
+            case '>':
+                buf += "&gt;";
+                break;
+            case '"':
+                buf += "&quot;";
+                break;
+            default:
+                buf += c;
+        }
+    }
+}
+
+std::string column_name(size_t col)
+{
+    std::string s;
+    do
+    {
+        s.insert(s.begin(), char('A' + col % 26));
+        col /= 26;
+    }
+    while (col--);
+
+    return s;
+}
+
+uint64_t splitmix64(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+constexpr double pi = 3.14159265358979323846;
+
+} // anonymous namespace
+
+synthetic_corpus::synthetic_corpus(const config& conf) :
+    m_config(conf), m_state(conf.seed)
+{
+    if (m_config.functions.empty())
+        m_config.functions = default_functions;
+
+    double total = 0.0;
+    for (const auto& entry : m_config.functions)
+    {
+        total += std::max(0.0, entry.second);
+        m_function_weights.push_back(total);
+    }
+}
+
+uint64_t synthetic_corpus::next()
+{
+    return splitmix64(m_state);
+}
+
+size_t synthetic_corpus::uniform(size_t n)
+{
+    return n ? next() % n : 0;
+}
+
+double synthetic_corpus::uniform_real()
+{
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+size_t synthetic_corpus::formula_length()
+{
+    size_t mean = std::max<size_t>(1, m_config.mean_length);
+    size_t n = 1;
+
+    switch (m_config.length_distribution)
+    {
+        case length_uniform:
+            n = 1 + uniform(2 * mean - 1);
+            break;
+        case length_geometric:
+        {
+            // number of trials until the first success, with the success
+            // probability of 1/mean.
+            if (mean > 1)
+            {
+                double p = 1.0 / mean;
+                n = 1 + size_t(std::log(1.0 - uniform_real()) / std::log(1.0 - p));
+            }
+            break;
+        }
+    }
+
+    return std::min(n, std::max<size_t>(1, m_config.max_length));
+}
+
+const std::string& synthetic_corpus::pick_function()
+{
+    double v = uniform_real() * m_function_weights.back();
+    auto it = std::upper_bound(m_function_weights.begin(), m_function_weights.end(), v);
+    if (it == m_function_weights.end())
+        --it;
+
+    return m_config.functions[std::distance(m_function_weights.begin(), it)].first;
+}
+
+void synthetic_corpus::append_operand(std::vector<token>& tokens)
+{
+    if (!m_names.empty() && uniform_real() < m_config.named_expression_density)
+    {
+        tokens.push_back({"named-expression", "name", *m_names[uniform(m_names.size())]});
+        return;
+    }
+
+    size_t v = uniform(100);
+
+    if (v < 40)
+    {
+        tokens.push_back({"single-ref", "reference", column_name(uniform(30)) + std::to_string(1 + uniform(1000))});
+    }
+    else if (v < 65)
+    {
+        std::string s = column_name(uniform(30)) + std::to_string(1 + uniform(1000));
+        s += ':';
+        s += column_name(uniform(30)) + std::to_string(1 + uniform(1000));
+        tokens.push_back({"range-ref", "reference", std::move(s)});
+    }
+    else if (v < 90)
+    {
+        tokens.push_back({"value", "value", std::to_string(uniform(10000))});
+    }
+    else
+    {
+        tokens.push_back({"string", "value", "text" + std::to_string(uniform(100))});
+    }
+}
+
+void synthetic_corpus::append_function(std::vector<token>& tokens, size_t length)
+{
+    // A call with n arguments takes 2n+2 tokens.
+    size_t max_args = std::max<size_t>(1, (length - 2) / 2);
+    size_t arg_count = 1 + uniform(std::min<size_t>(max_args, 4));
+
+    tokens.push_back({"function", "function", pick_function()});
+    tokens.push_back({"open", "operator", "("});
+
+    for (size_t i = 0; i < arg_count; ++i)
+    {
+        if (i)
+            tokens.push_back({"sep", "operator", ","});
+
+        append_operand(tokens);
+    }
+
+    tokens.push_back({"close", "operator", ")"});
+}
+
+void synthetic_corpus::generate_formula(std::vector<token>& tokens)
+{
+    tokens.clear();
+    size_t length = formula_length();
+
+    while (tokens.size() < length)
+    {
+        if (!tokens.empty())
+        {
+            const binary_op& op = binary_ops[uniform(std::size(binary_ops))];
+            tokens.push_back({op.op, "operator", op.symbol});
+        }
+
+        size_t remaining = length > tokens.size() ? length - tokens.size() : 1;
+        if (remaining >= 4 && uniform(2))
+            append_function(tokens, remaining);
+        else
+            append_operand(tokens);
+    }
+}
+
+size_t synthetic_corpus::document_size()
+{
+    size_t mean = std::max<size_t>(1, m_config.mean_formulas);
+
+    switch (m_config.size_distribution)
+    {
+        case size_fixed:
+            return mean;
+        case size_uniform:
+            return 1 + uniform(2 * mean - 1);
+        case size_lognormal:
+        {
+            // Box-Muller transform for a standard normal variate.
+            double u1 = 1.0 - uniform_real();
+            double u2 = uniform_real();
+            double z = std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * pi * u2);
+
+            double sigma = m_config.size_sigma;
+            double mu = std::log(double(mean)) - sigma * sigma / 2.0;
+            return std::max<size_t>(1, std::llround(std::exp(mu + sigma * z)));
+        }
+    }
+
+    return mean;
+}
+
+void synthetic_corpus::write_document(std::string& buf, const std::string& filepath, size_t formula_count)
+{
+    size_t sheet_count = 1 + uniform(std::max<size_t>(1, m_config.max_sheets));
+    std::vector<std::string> sheets;
+    for (size_t i = 0; i < sheet_count; ++i)
+        sheets.push_back("Sheet" + std::to_string(i + 1));
+
+    buf += "<doc filepath=\"";
+    append_escaped(buf, filepath);
+    buf += "\"><sheets count=\"";
+    buf += std::to_string(sheet_count);
+    buf += "\">";
+
+    for (const std::string& sheet : sheets)
+    {
+        buf += "<sheet name=\"";
+        buf += sheet;
+        buf += "\"/>";
+    }
+
+    buf += "</sheets><named-expressions>";
+
+    // Each named expression is either global or local to one sheet.
+    struct named_expression
+    {
+        std::string name;
+        size_t sheet; // sheet_count if global.
+    };
+
+    std::vector<named_expression> names;
+    for (size_t i = 0; i < m_config.named_expressions; ++i)
+    {
+        named_expression ne;
+        ne.sheet = uniform(2) ? sheet_count : uniform(sheet_count);
+        ne.name = (ne.sheet == sheet_count ? "Global" : "Local") + std::to_string(i + 1);
+
+        const std::string& target_sheet = sheets[uniform(sheet_count)];
+        std::string ref = "$" + target_sheet + ".$" + column_name(uniform(30)) + "$" + std::to_string(1 + uniform(1000));
+
+        buf += "<named-expression name=\"";
+        buf += ne.name;
+        buf += "\" origin=\"$";
+        buf += target_sheet;
+        buf += ".$A$1\" formula=\"";
+        buf += ref;
+
+        if (ne.sheet == sheet_count)
+            buf += "\" scope=\"global\">";
+        else
+        {
+            buf += "\" scope=\"sheet\" sheet=\"";
+            buf += sheets[ne.sheet];
+            buf += "\">";
+        }
+
+        buf += "<token s=\"";
+        buf += ref;
+        buf += "\" type=\"reference\" op=\"single-ref\"/></named-expression>";
+
+        names.push_back(std::move(ne));
+    }
+
+    buf += "</named-expressions><formulas>";
+
+    std::vector<token> tokens;
+    std::string formula;
+    std::vector<size_t> rows(sheet_count, 0);
+
+    for (size_t i = 0; i < formula_count; ++i)
+    {
+        size_t sheet = uniform(sheet_count);
+        size_t row = rows[sheet]++;
+
+        m_names.clear();
+        for (const named_expression& ne : names)
+        {
+            if (ne.sheet == sheet_count || ne.sheet == sheet)
+                m_names.push_back(&ne.name);
+        }
+
+        bool invalid = uniform_real() < m_config.invalid_fraction;
+        bool error = invalid && uniform(2);
+
+        generate_formula(tokens);
+
+        if (invalid && !error)
+        {
+            tokens.push_back({"plus", "operator", "+"});
+            tokens.push_back({"named-expression", "name", undefined_name});
+        }
+
+        formula = "=";
+        for (const token& t : tokens)
+        {
+            if (!std::strcmp(t.op, "string"))
+                formula += '"' + t.s + '"';
+            else
+                formula += t.s;
+        }
+
+        buf += "<formula sheet=\"";
+        buf += sheets[sheet];
+        buf += "\" row=\"";
+        buf += std::to_string(row);
+        buf += "\" column=\"0\" formula=\"";
+
+        if (error)
+        {
+            // Formula that failed to compile, without tokens.
+            append_escaped(buf, formula);
+            buf += "\" error=\"";
+            buf += errors[uniform(std::size(errors))];
+            buf += "\" valid=\"false\"/>";
+            continue;
+        }
+
+        append_escaped(buf, formula);
+        buf += "\" valid=\"true\">";
+
+        for (const token& t : tokens)
+        {
+            buf += "<token s=\"";
+            append_escaped(buf, t.s);
+            buf += "\" type=\"";
+            buf += t.type;
+            buf += "\" op=\"";
+            buf += t.op;
+            buf += "\"/>";
+        }
+
+        buf += "</formula>";
+    }
+
+    m_names.clear();
+    buf += "</formulas></doc>";
+}
+
+std::vector<std::string> synthetic_corpus::to_names(const std::vector<token>& tokens)
+{
+    std::vector<std::string> names;
+    names.reserve(tokens.size());
+
+    for (const token& t : tokens)
+    {
+        if (!std::strcmp(t.type, "function"))
+            names.push_back("func:" + t.s);
+        else
+            names.push_back(t.op);
+    }
+
+    return names;
+}
+
+uint64_t synthetic_corpus::document_seed(uint64_t seed, uint64_t index)
+{
+    uint64_t state = seed ^ (index * 0xD1B54A32D192ED03ull);
+    return splitmix64(state);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,126 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Generates random but reproducible formula data in the XML format parsed
+ * by formula_xml_processor.  The output only depends on the seed and the
+ * configuration, not on the standard library implementation.
+ */
+class synthetic_corpus
+{
+public:
+    enum length_distribution_type { length_uniform, length_geometric };
+
+    enum size_distribution_type { size_fixed, size_uniform, size_lognormal };
+
+    struct config
+    {
+        uint64_t seed = 0;
+
+        /** distribution of the number of tokens per formula. */
+        length_distribution_type length_distribution = length_geometric;
+        size_t mean_length = 8;
+        size_t max_length = 64;
+
+        /** distribution of the number of formulas per document. */
+        size_distribution_type size_distribution = size_lognormal;
+        size_t mean_formulas = 1000;
+        double size_sigma = 1.0; // sigma of the underlying normal distribution.
+
+        /**
+         * Function names with their relative weights.  A default mix of
+         * common functions is used when empty.
+         */
+        std::vector<std::pair<std::string, double>> functions;
+
+        /** maximum number of sheets per document. */
+        size_t max_sheets = 3;
+
+        /** number of named expressions defined per document. */
+        size_t named_expressions = 4;
+
+        /** probability of an operand being a named expression. */
+        double named_expression_density = 0.02;
+
+        /**
+         * Fraction of invalid formulas.  Half of them are formulas with
+         * errors, and the other half refer to undefined named expressions.
+         */
+        double invalid_fraction = 0.05;
+    };
+
+    struct token
+    {
+        const char* op;   // op attribute value.
+        const char* type; // type attribute value.
+        std::string s;    // s attribute value.
+    };
+
+private:
+    config m_config;
+    uint64_t m_state;
+    std::vector<double> m_function_weights; // cumulative
+
+    /** names that are valid in the sheet of the current formula. */
+    std::vector<const std::string*> m_names;
+
+    uint64_t next();
+
+    /** @return random value in [0, n). */
+    size_t uniform(size_t n);
+
+    /** @return random value in [0, 1). */
+    double uniform_real();
+
+    size_t formula_length();
+
+    const std::string& pick_function();
+
+    void append_operand(std::vector<token>& tokens);
+
+    void append_function(std::vector<token>& tokens, size_t length);
+
+public:
+    synthetic_corpus(const config& conf);
+
+    /**
+     * Draw the number of formulas of a document from the document size
+     * distribution.
+     */
+    size_t document_size();
+
+    /**
+     * Generate the tokens of one formula.
+     */
+    void generate_formula(std::vector<token>& tokens);
+
+    /**
+     * Generate a document with the specified number of formulas, and append
+     * its XML to a buffer.
+     */
+    void write_document(std::string& buf, const std::string& filepath, size_t formula_count);
+
+    /**
+     * Convert tokens to names as understood by encode_names_to_tokens().
+     */
+    static std::vector<std::string> to_names(const std::vector<token>& tokens);
+
+    /**
+     * @return seed for the generator of an individual document, so that
+     *         documents can be generated independently of each other.
+     */
+    static uint64_t document_seed(uint64_t seed, uint64_t index);
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
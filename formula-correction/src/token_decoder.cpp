@@ -10,80 +10,191 @@
 
 #include <ixion/formula_function_opcode.hpp>
 #include <ixion/formula_opcode.hpp>
-#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <stdexcept>
 
-std::vector<std::string> decode_tokens_to_names(const std::vector<uint16_t>& tokens)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr uint16_t func_id_base = 32;
+
+uint16_t to_token_id(uint16_t v)
 {
-    std::vector<std::string> decoded;
-    decoded.reserve(tokens.size());
+    uint16_t op = v & 0x001F;
+    return op == ixion::fop_function - 1 ? (v >> 5) + func_id_base : op;
+}
+
+std::vector<std::string> decode_to_strings(const std::vector<uint16_t>& tokens, token_string_table::kind_type kind)
+{
+    std::vector<std::string_view> views(tokens.size());
+    decode_tokens(tokens.data(), tokens.size(), kind, views.data());
 
-    for (const uint16_t v : tokens)
+    return std::vector<std::string>(views.begin(), views.end());
+}
+
+} // anonymous namespace
+
+void decode_token_ids(const uint16_t* tokens, size_t n, uint16_t* ids)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i op_mask = _mm_set1_epi16(0x001F);
+    const __m128i func_op = _mm_set1_epi16(ixion::fop_function - 1);
+    const __m128i func_base = _mm_set1_epi16(func_id_base);
+
+    for (; i + 8 <= n; i += 8)
     {
-        // extract the opcode value
-        uint16_t ttv = (v & 0x001F) + 1;
-        ixion::fopcode_t op = static_cast<ixion::fopcode_t>(ttv);
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tokens + i));
+        __m128i op = _mm_and_si128(v, op_mask);
+        __m128i func = _mm_add_epi16(_mm_srli_epi16(v, 5), func_base);
+
+        // Pick the function identifier where the opcode is a function.
+        __m128i is_func = _mm_cmpeq_epi16(op, func_op);
+        __m128i id = _mm_or_si128(_mm_and_si128(is_func, func), _mm_andnot_si128(is_func, op));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(ids + i), id);
+    }
+#endif
 
-        switch (op)
+    for (; i < n; ++i)
+        ids[i] = to_token_id(tokens[i]);
+}
+
+token_string_table::token_string_table(kind_type kind)
+{
+    m_offsets.reserve(token_id_count + 1);
+
+    for (size_t id = 0; id < token_id_count; ++id)
+    {
+        m_offsets.push_back(m_strings.size());
+
+        if (id >= func_id_base)
         {
-            case ixion::fop_error:
-                decoded.push_back("<error>");
-                break;
-            case ixion::fop_function:
-            {
-                // Extract the function token value.
-                uint16_t ftv = v & 0xFFE0;
-                ftv = (ftv >> 5) + 1;
-                auto fft = static_cast<ixion::formula_function_t>(ftv);
-                std::ostringstream os;
-                os << "func:" << ixion::get_formula_function_name(fft);
-                decoded.push_back(os.str());
-                break;
-            }
-            default:
-            {
-                decoded.push_back(to_string(op).str());
-            }
+            auto fft = static_cast<ixion::formula_function_t>(id - func_id_base + 1);
+            if (kind == names)
+                m_strings += "func:";
+            m_strings += std::string(ixion::get_formula_function_name(fft));
+            continue;
         }
+
+        auto op = static_cast<ixion::fopcode_t>(id + 1);
+
+        if (op == ixion::fop_error)
+            m_strings += "<error>";
+        else if (op == ixion::fop_function)
+            ; // function tokens use the identifiers from func_id_base.
+        else if (op > ixion::fop_error)
+            m_strings += "???"; // not a valid opcode.
+        else if (kind == names)
+            m_strings += to_string(op).str();
+        else
+            m_strings += to_symbol(op).str();
+    }
+
+    m_offsets.push_back(m_strings.size());
+}
+
+const token_string_table& token_string_table::get(kind_type kind)
+{
+    static const token_string_table name_table(names);
+    static const token_string_table symbol_table(symbols);
+    return kind == names ? name_table : symbol_table;
+}
+
+void token_string_table::append(std::string& buf, const uint16_t* ids, size_t n, char sep) const
+{
+    for (const uint16_t* end = ids + n; ids != end; ++ids)
+    {
+        buf.append(m_strings, m_offsets[*ids], m_offsets[*ids+1] - m_offsets[*ids]);
+        buf.push_back(sep);
     }
+}
 
-    return decoded;
+void decode_tokens(
+    const uint16_t* tokens, size_t n, token_string_table::kind_type kind, std::string_view* decoded)
+{
+    const token_string_table& table = token_string_table::get(kind);
+
+    // Decode the identifiers in chunks small enough for the stack.
+    constexpr size_t chunk_size = 64;
+    uint16_t ids[chunk_size];
+
+    while (n)
+    {
+        size_t len = std::min(n, chunk_size);
+        decode_token_ids(tokens, len, ids);
+
+        for (size_t i = 0; i < len; ++i)
+            decoded[i] = table[ids[i]];
+
+        tokens += len;
+        decoded += len;
+        n -= len;
+    }
+}
+
+std::vector<std::string> decode_tokens_to_names(const std::vector<uint16_t>& tokens)
+{
+    return decode_to_strings(tokens, token_string_table::names);
 }
 
 std::vector<std::string> decode_tokens_to_symbols(const std::vector<uint16_t>& tokens)
 {
-    std::vector<std::string> decoded;
-    decoded.reserve(tokens.size());
+    return decode_to_strings(tokens, token_string_table::symbols);
+}
+
+std::vector<uint16_t> encode_names_to_tokens(const std::vector<std::string>& names)
+{
+    static const std::string func_prefix = "func:";
+
+    std::vector<uint16_t> tokens;
+    tokens.reserve(names.size());
 
-    for (const uint16_t v : tokens)
+    for (const std::string& name : names)
     {
-        // extract the opcode value
-        uint16_t ttv = (v & 0x001F) + 1;
-        ixion::fopcode_t op = static_cast<ixion::fopcode_t>(ttv);
+        if (!name.empty() && std::all_of(name.begin(), name.end(), [](char c) { return std::isdigit(c); }))
+        {
+            unsigned long v = std::stoul(name);
+            if (v > std::numeric_limits<uint16_t>::max())
+                throw std::invalid_argument("token value is out of range: " + name);
+
+            tokens.push_back(v);
+            continue;
+        }
 
-        switch (op)
+        if (name == "<error>")
         {
-            case ixion::fop_error:
-                decoded.push_back("<error>");
-                break;
-            case ixion::fop_function:
-            {
-                // Extract the function token value.
-                uint16_t ftv = v & 0xFFE0;
-                ftv = (ftv >> 5) + 1;
-                auto fft = static_cast<ixion::formula_function_t>(ftv);
-                std::ostringstream os;
-                os << ixion::get_formula_function_name(fft);
-                decoded.push_back(os.str());
-                break;
-            }
-            default:
-            {
-                decoded.push_back(to_symbol(op).str());
-            }
+            tokens.push_back(ixion::fop_error - 1);
+            continue;
         }
+
+        if (!name.compare(0, func_prefix.size(), func_prefix))
+        {
+            const char* p = name.data() + func_prefix.size();
+            size_t n = name.size() - func_prefix.size();
+            uint16_t ftv = uint16_t(ixion::get_formula_function_opcode(p, n));
+
+            if (!ftv)
+                throw std::invalid_argument("unknown function: " + name);
+
+            // Same encoding as in formula_xml_processor.
+            tokens.push_back(((ftv - 1) << 5) + ixion::fop_function - 1);
+            continue;
+        }
+
+        ixion::fopcode_t op = to_formula_op(name.data(), name.size());
+        if (op == ixion::fop_unknown || op == ixion::fop_function)
+            throw std::invalid_argument("unknown token name: " + name);
+
+        tokens.push_back(op - 1);
     }
 
-    return decoded;
+    return tokens;
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
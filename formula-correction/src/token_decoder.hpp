@@ -7,11 +7,85 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+/**
+ * Number of compact token identifiers.  A non-function token is identified
+ * by its 5-bit opcode field (0-31), and a function token by 32 plus its
+ * 11-bit function field, so that each distinct name has its own
+ * identifier.
+ */
+constexpr size_t token_id_count = 32 + 2048;
+
+/**
+ * Map a contiguous run of token values to their compact identifiers.  The
+ * fields are extracted eight tokens at a time with SSE2 where available,
+ * and one at a time otherwise.
+ *
+ * @param tokens token values.
+ * @param n number of token values.
+ * @param ids buffer to receive n identifiers.
+ */
+void decode_token_ids(const uint16_t* tokens, size_t n, uint16_t* ids);
+
+/**
+ * Names or symbols of all compact token identifiers, stored back to back
+ * in a single string with an offset for each identifier.
+ */
+class token_string_table
+{
+    std::string m_strings;
+    std::vector<uint32_t> m_offsets; // token_id_count + 1 offsets.
+
+public:
+    enum kind_type { names, symbols };
+
+    explicit token_string_table(kind_type kind);
+
+    /**
+     * @return the shared table of the specified kind, built on first use.
+     */
+    static const token_string_table& get(kind_type kind);
+
+    std::string_view operator[] (uint16_t id) const
+    {
+        return std::string_view(m_strings.data() + m_offsets[id], m_offsets[id+1] - m_offsets[id]);
+    }
+
+    /**
+     * Append the strings of the specified identifiers to a buffer, each
+     * followed by a separator.
+     */
+    void append(std::string& buf, const uint16_t* ids, size_t n, char sep) const;
+};
+
+/**
+ * Decode token values into views of the shared name or symbol table.  This
+ * does not allocate, and the views remain valid for the lifetime of the
+ * program.
+ *
+ * @param tokens token values.
+ * @param n number of token values.
+ * @param kind names or symbols.
+ * @param decoded buffer to receive n views.
+ */
+void decode_tokens(
+    const uint16_t* tokens, size_t n, token_string_table::kind_type kind, std::string_view* decoded);
+
 std::vector<std::string> decode_tokens_to_names(const std::vector<uint16_t>& tokens);
 
 std::vector<std::string> decode_tokens_to_symbols(const std::vector<uint16_t>& tokens);
 
+/**
+ * Encode token names as generated by decode_tokens_to_names() back into
+ * token values.  A name consisting only of digits is taken as a token value
+ * as is.
+ *
+ * @throw std::invalid_argument if a name is not recognized.
+ */
+std::vector<uint16_t> encode_names_to_tokens(const std::vector<std::string>& names);
+
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
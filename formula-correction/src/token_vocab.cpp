@@ -0,0 +1,185 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "token_vocab.hpp"
+#include "token_decoder.hpp"
+
+#include <algorithm>
+#include <future>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+constexpr size_t token_value_count = size_t(std::numeric_limits<uint16_t>::max()) + 1;
+
+/**
+ * Count the tokens of the entries under a range of top-level nodes.
+ */
+std::vector<uint64_t> count_range(
+    const flat_trie& trie, const flat_trie::node_type* first, const flat_trie::node_type* last)
+{
+    std::vector<uint64_t> counts(token_value_count, 0);
+    flat_trie::key_type key;
+
+    for (; first != last; ++first)
+    {
+        key.assign(1, first->label);
+        trie.for_each_under(*first, key,
+            [&counts](const flat_trie::key_type& k, uint32_t count)
+            {
+                for (const uint16_t v : k)
+                    counts[v] += count;
+            }
+        );
+    }
+
+    return counts;
+}
+
+void throw_invalid(size_t line_no, const char* reason)
+{
+    std::ostringstream os;
+    os << "token vocabulary: line " << line_no << ": " << reason;
+    throw std::runtime_error(os.str());
+}
+
+} // anonymous namespace
+
+token_vocab::token_vocab() :
+    m_tokens(1, 0), m_counts(1, 0), m_ids(token_value_count, unknown_id) {}
+
+void token_vocab::assign(std::vector<uint16_t> tokens, std::vector<uint64_t> counts)
+{
+    m_tokens = std::move(tokens);
+    m_counts = std::move(counts);
+    std::fill(m_ids.begin(), m_ids.end(), unknown_id);
+
+    for (size_t id = 1; id < m_tokens.size(); ++id)
+        m_ids[m_tokens[id]] = id;
+}
+
+token_vocab token_vocab::build(const flat_trie& trie, size_t thread_count)
+{
+    std::vector<uint64_t> counts(token_value_count, 0);
+
+    if (trie.size())
+    {
+        const flat_trie::node_type* first = trie.children_begin(trie.root());
+        const flat_trie::node_type* last = trie.children_end(trie.root());
+        size_t n = last - first;
+        size_t chunk_count = std::max<size_t>(1, std::min(thread_count, n));
+
+        std::vector<std::future<std::vector<uint64_t>>> futures;
+        for (size_t i = 0; i < chunk_count; ++i)
+        {
+            futures.push_back(std::async(std::launch::async, count_range,
+                std::cref(trie), first + n * i / chunk_count, first + n * (i + 1) / chunk_count));
+        }
+
+        for (auto& f : futures)
+        {
+            std::vector<uint64_t> part = f.get();
+            for (size_t v = 0; v < token_value_count; ++v)
+                counts[v] += part[v];
+        }
+    }
+
+    std::vector<uint16_t> order;
+    for (size_t v = 0; v < token_value_count; ++v)
+    {
+        if (counts[v])
+            order.push_back(v);
+    }
+
+    std::stable_sort(order.begin(), order.end(),
+        [&counts](uint16_t l, uint16_t r) { return counts[l] > counts[r]; });
+
+    std::vector<uint16_t> tokens(1, 0);
+    std::vector<uint64_t> id_counts(1, 0);
+    for (const uint16_t v : order)
+    {
+        tokens.push_back(v);
+        id_counts.push_back(counts[v]);
+    }
+
+    token_vocab vocab;
+    vocab.assign(std::move(tokens), std::move(id_counts));
+    return vocab;
+}
+
+void token_vocab::load(std::istream& is)
+{
+    std::vector<uint16_t> tokens(1, 0);
+    std::vector<uint64_t> counts(1, 0);
+    std::vector<bool> seen(token_value_count, false);
+
+    std::string line;
+    for (size_t line_no = 1; std::getline(is, line); ++line_no)
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream ls(line);
+        size_t id = 0, token = 0;
+        uint64_t count = 0;
+        if (!(ls >> id >> token >> count))
+            throw_invalid(line_no, "expected an identifier, a token value and a frequency.");
+
+        if (id != tokens.size())
+            throw_invalid(line_no, "identifiers must be consecutive from 1.");
+
+        if (id >= token_value_count || token >= token_value_count)
+            throw_invalid(line_no, "identifier or token value out of range.");
+
+        if (seen[token])
+            throw_invalid(line_no, "duplicate token value.");
+
+        seen[token] = true;
+        tokens.push_back(token);
+        counts.push_back(count);
+    }
+
+    assign(std::move(tokens), std::move(counts));
+}
+
+void token_vocab::save(std::ostream& os) const
+{
+    os << "# id\ttoken\tcount\tname\n";
+
+    for (size_t id = 1; id < m_tokens.size(); ++id)
+    {
+        std::vector<std::string> names = decode_tokens_to_names({m_tokens[id]});
+        os << id << '\t' << m_tokens[id] << '\t' << m_counts[id] << '\t' << names.front() << '\n';
+    }
+}
+
+size_t token_vocab::size() const
+{
+    return m_tokens.size();
+}
+
+uint16_t token_vocab::to_token(uint16_t id) const
+{
+    return id < m_tokens.size() ? m_tokens[id] : 0;
+}
+
+uint64_t token_vocab::count(uint16_t id) const
+{
+    return id < m_counts.size() ? m_counts[id] : 0;
+}
+
+void token_vocab::remap(const uint16_t* tokens, size_t n, uint16_t* ids) const
+{
+    std::transform(tokens, tokens + n, ids, [this](uint16_t v) { return m_ids[v]; });
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
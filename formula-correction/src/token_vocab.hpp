@@ -0,0 +1,82 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "flat_trie.hpp"
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+/**
+ * Dense vocabulary of the token values that occur in a trie.  The token
+ * values are sparse 16-bit numbers of which only a few hundred are in use,
+ * so each one in use is given a dense identifier in descending order of its
+ * frequency, starting at 1.  Identifier 0 is reserved for the token values
+ * not in the vocabulary, and can double as padding.
+ *
+ * The vocabulary file is a text file with one line per identifier in
+ * ascending order from 1, each consisting of the identifier, the token
+ * value, the frequency and the token name separated by tabs.  Lines
+ * starting with '#' are comments.
+ */
+class token_vocab
+{
+    std::vector<uint16_t> m_tokens; // token value of each identifier.
+    std::vector<uint64_t> m_counts; // frequency of each identifier.
+    std::vector<uint16_t> m_ids; // identifier of each token value.
+
+    void assign(std::vector<uint16_t> tokens, std::vector<uint64_t> counts);
+
+public:
+    static constexpr uint16_t unknown_id = 0;
+
+    token_vocab();
+
+    /**
+     * Build the vocabulary of a trie.  A token is counted once for every
+     * occurrence of every formula expression that contains it, i.e. the
+     * frequencies are weighted by the counts of the expressions.  Tokens
+     * with the same frequency are ordered by their values.  The top-level
+     * sub-trees are counted on up to the specified number of threads.
+     */
+    static token_vocab build(const flat_trie& trie, size_t thread_count);
+
+    /**
+     * @throw std::runtime_error if the content is not a valid vocabulary.
+     */
+    void load(std::istream& is);
+
+    void save(std::ostream& os) const;
+
+    /**
+     * @return number of identifiers including the reserved one.
+     */
+    size_t size() const;
+
+    uint16_t to_id(uint16_t token) const
+    {
+        return m_ids[token];
+    }
+
+    /**
+     * @return token value of an identifier.  The reserved identifier maps
+     *         to 0.
+     */
+    uint16_t to_token(uint16_t id) const;
+
+    uint64_t count(uint16_t id) const;
+
+    /**
+     * Map a contiguous run of token values to their identifiers.  The
+     * output buffer may be the same as the input.
+     */
+    void remap(const uint16_t* tokens, size_t n, uint16_t* ids) const;
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -6,51 +6,252 @@
  */
 
 #include "trie_builder.hpp"
+#include "flat_trie.hpp"
+#include "trie_container.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
 using namespace std;
 
-trie_builder::trie_builder() {}
-trie_builder::trie_builder(trie_builder&& other) : m_trie(std::move(other.m_trie)) {}
+namespace {
+
+/**
+ * Approximate size of a trie_map node, including that of the std::map
+ * entry it is stored in.
+ */
+constexpr size_t trie_node_size = 96;
+
+} // anonymous namespace
+
+trie_builder::trie_builder(build_mode mode) : m_mode(mode) {}
+trie_builder::trie_builder(trie_builder&& other) :
+    m_mode(other.m_mode),
+    m_trie(std::move(other.m_trie)),
+    m_key_tokens(other.m_key_tokens),
+    m_arena(std::move(other.m_arena)) {}
+
+void trie_builder::insert_sequence(const uint16_t* p, size_t n, int count)
+{
+    if (m_mode == build_mode::sort)
+    {
+        m_arena.insert(p, n, count);
+        return;
+    }
+
+    std::vector<uint16_t> key(p, p + n);
+    auto it = m_trie.find(key);
 
-void trie_builder::insert_formula(const std::vector<uint16_t>& tokens)
+    if (it == m_trie.end())
+    {
+        m_trie.insert(key, count);
+        m_key_tokens += n;
+    }
+    else
+        it->second += count;
+}
+
+trie_builder::build_mode trie_builder::mode() const
+{
+    return m_mode;
+}
+
+void trie_builder::insert_formula(const std::vector<uint16_t>& tokens, int count)
 {
     if (tokens.empty())
         return;
 
+    if (m_mode == build_mode::sort)
+    {
+        m_arena.insert(tokens.data(), tokens.size(), count);
+        return;
+    }
+
     auto it = m_trie.find(tokens);
 
     if (it == m_trie.end())
-        m_trie.insert(tokens, 1);
+    {
+        m_trie.insert(tokens, count);
+        m_key_tokens += tokens.size();
+    }
     else
-        ++it->second; // increment the counter.
+        it->second += count; // increment the counter.
 }
 
 void trie_builder::merge(const trie_builder& other)
 {
+    if (other.m_mode == build_mode::sort)
+    {
+        if (m_mode == build_mode::sort)
+            m_arena.merge(other.m_arena);
+        else
+        {
+            for (const auto& e : other.m_arena.entries())
+                insert_sequence(other.m_arena.data(e), e.length, e.count);
+        }
+        return;
+    }
+
+    if (m_mode == build_mode::sort)
+    {
+        for (const auto& entry : other.m_trie)
+            insert_sequence(entry.first.data(), entry.first.size(), entry.second);
+        return;
+    }
+
     for (const auto& entry : other.m_trie)
     {
         auto it = m_trie.find(entry.first);
         if (it == m_trie.end())
+        {
             m_trie.insert(entry.first, entry.second);
+            m_key_tokens += entry.first.size();
+        }
         else
             it->second += entry.second;
     }
 }
 
-void trie_builder::write(std::ostream& os)
+void trie_builder::subtract(const trie_builder& other)
+{
+    if (m_mode == build_mode::sort || other.m_mode == build_mode::sort)
+        throw std::logic_error("trie_builder::subtract: not supported in the sort mode.");
+
+    for (const auto& entry : other.m_trie)
+    {
+        auto it = m_trie.find(entry.first);
+        if (it == m_trie.end() || it->second < entry.second)
+            throw std::runtime_error("trie_builder::subtract: entry to subtract is not in the trie.");
+
+        if (it->second == entry.second)
+        {
+            m_trie.erase(entry.first);
+            m_key_tokens -= entry.first.size();
+        }
+        else
+            it->second -= entry.second;
+    }
+}
+
+void trie_builder::write(std::ostream& os, phase_time* pack_time)
 {
-    auto packed = m_trie.pack();
-    packed.save_state(os);
+    phase_timer timer;
+    const size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    std::ostringstream state;
+
+    if (m_mode == build_mode::sort)
+    {
+        // The packed trie is built directly from the sorted sequences.
+        m_arena.sort(thread_count);
+
+        std::vector<map_type::packed_type::entry> entries;
+        entries.reserve(m_arena.size());
+        for (const auto& e : m_arena.entries())
+            entries.push_back({m_arena.data(e), e.length, int(e.count)});
+
+        map_type::packed_type packed(entries.data(), entries.size());
+
+        if (pack_time)
+            timer.lap(*pack_time);
+
+        packed.save_state(state);
+    }
+    else
+    {
+        auto packed = m_trie.pack();
+
+        if (pack_time)
+            timer.lap(*pack_time);
+
+        packed.save_state(state);
+    }
+
+    trie_container::write(os, size(), state.str(), thread_count);
+}
+
+void trie_builder::write_flat(std::ostream& os) const
+{
+    flat_trie_writer writer(os);
+
+    if (m_mode == build_mode::sort)
+    {
+        if (m_arena.sorted())
+        {
+            for (const auto& e : m_arena.entries())
+                writer.append(m_arena.data(e), e.length, e.count);
+        }
+        else
+        {
+            // Sort a copy of the entries, and leave the arena as it is.
+            auto entries = m_arena.entries();
+            std::sort(entries.begin(), entries.end(),
+                [this](const sequence_arena::entry& l, const sequence_arena::entry& r)
+                { return m_arena.less(l, r); });
+
+            for (const auto& e : entries)
+                writer.append(m_arena.data(e), e.length, e.count);
+        }
+
+        writer.finish();
+        return;
+    }
+
+    // The entries come out of the trie in ascending key order.
+    for (const auto& entry : m_trie)
+        writer.append(entry.first.data(), entry.first.size(), entry.second);
+
+    writer.finish();
+}
+
+void trie_builder::load(std::istream& is)
+{
+    std::string content((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+
+    map_type::packed_type packed;
+    trie_container::load(
+        content.data(), content.size(), packed, std::max(1u, std::thread::hardware_concurrency()));
+
+    if (m_mode == build_mode::sort)
+    {
+        sequence_arena arena;
+        for (const auto& entry : packed)
+            arena.insert(entry.first.data(), entry.first.size(), entry.second);
+
+        m_arena.swap(arena);
+        return;
+    }
+
+    map_type trie;
+    size_t key_tokens = 0;
+    for (const auto& entry : packed)
+    {
+        trie.insert(entry.first, entry.second);
+        key_tokens += entry.first.size();
+    }
+
+    m_trie.swap(trie);
+    m_key_tokens = key_tokens;
 }
 
 size_t trie_builder::size() const
 {
-    return m_trie.size();
+    return m_mode == build_mode::sort ? m_arena.size() : m_trie.size();
+}
+
+size_t trie_builder::memory_size() const
+{
+    return m_mode == build_mode::sort ? m_arena.memory_size() : m_key_tokens * trie_node_size;
 }
 
 void trie_builder::swap(trie_builder& other)
 {
+    std::swap(m_mode, other.m_mode);
     m_trie.swap(other.m_trie);
+    std::swap(m_key_tokens, other.m_key_tokens);
+    m_arena.swap(other.m_arena);
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -7,27 +7,97 @@
 
 #pragma once
 
+#include "phase_timer.hpp"
+#include "sequence_arena.hpp"
+
 #include <mdds/trie_map.hpp>
 
 class trie_builder
 {
+public:
+    enum class build_mode
+    {
+        /** insert each formula into a mutable trie. */
+        trie,
+        /**
+         * append each distinct formula to a flat token arena, and build the
+         * packed trie from the sorted sequences when writing.  Subtracting
+         * is not supported in this mode.
+         */
+        sort
+    };
+
+private:
     using key_trait = mdds::trie::std_container_trait<std::vector<uint16_t>>;
     using map_type = mdds::trie_map<key_trait, int>;
 
+    build_mode m_mode;
     map_type m_trie;
+    size_t m_key_tokens = 0; // total length of the keys in the trie mode.
+    sequence_arena m_arena;
+
+    void insert_sequence(const uint16_t* p, size_t n, int count);
 
 public:
-    trie_builder();
+    trie_builder(build_mode mode = build_mode::trie);
     trie_builder(trie_builder&& other);
 
-    void insert_formula(const std::vector<uint16_t>& tokens);
+    build_mode mode() const;
+
+    /**
+     * Add a formula, or add to its count if it is already present.
+     */
+    void insert_formula(const std::vector<uint16_t>& tokens, int count = 1);
 
+    /**
+     * Add the counts of another trie to this one.  The other trie may be
+     * in a different build mode.
+     */
     void merge(const trie_builder& other);
 
-    void write(std::ostream& os);
+    /**
+     * Subtract the counts of another trie from this one.  Entries whose
+     * counts drop to zero are removed.  Every entry of the other trie must
+     * exist in this trie with a count at least as large.
+     */
+    void subtract(const trie_builder& other);
+
+    /**
+     * Pack the trie and write it in the packed format, wrapped in the
+     * checksummed and compressed container described in trie_container.hpp.
+     * In the sort mode, this sorts the sequences in the arena first, which
+     * is counted as part of the packing.
+     *
+     * @param pack_time if not null, the time taken to pack the trie is
+     *                  added to it.
+     */
+    void write(std::ostream& os, phase_time* pack_time = nullptr);
+
+    /**
+     * Write the trie in the flat layout that can be memory-mapped and
+     * queried in place.  The output stream must be seekable.
+     */
+    void write_flat(std::ostream& os) const;
+
+    /**
+     * Replace the content with the packed trie previously written by
+     * write().
+     *
+     * @throw std::runtime_error if the data is truncated, damaged, or of an
+     *        unsupported version.
+     */
+    void load(std::istream& is);
 
     size_t size() const;
 
+    /**
+     * @return approximate number of bytes used by the entries.  In the trie
+     *         mode, this assumes one trie node per key token, which is an
+     *         upper bound since keys share the nodes of their common
+     *         prefixes.
+     */
+    size_t memory_size() const;
+
     void swap(trie_builder& other);
 };
 
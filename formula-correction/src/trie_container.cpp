@@ -0,0 +1,331 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "trie_container.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <zlib.h>
+
+namespace trie_container {
+
+namespace {
+
+constexpr size_t header_size = sizeof(magic) + 4 + 4 + 8 + 4 + 4;
+constexpr size_t section_header_size = 4 + 4 + 8 + 4 + 4;
+constexpr size_t block_entry_size = 4 + 4 + 4;
+
+struct block
+{
+    uint32_t raw_size;
+    uint32_t compressed_size;
+    uint32_t crc;
+    const char* data; // compressed bytes, when reading.
+    size_t raw_offset;
+};
+
+uint32_t crc32_of(const char* p, size_t n)
+{
+    return crc32_z(0L, reinterpret_cast<const Bytef*>(p), z_size_t(n));
+}
+
+/**
+ * Combine the checksums of the uncompressed blocks into the checksum of
+ * the whole uncompressed content.
+ */
+uint32_t combine_crcs(const std::vector<block>& blocks, const std::vector<uint32_t>& crcs)
+{
+    uLong crc = crc32(0L, Z_NULL, 0);
+    for (size_t i = 0; i < blocks.size(); ++i)
+        crc = crc32_combine(crc, crcs[i], blocks[i].raw_size);
+
+    return crc;
+}
+
+void append_u32(std::string& buf, uint32_t v)
+{
+    for (size_t i = 0; i < 4; ++i)
+        buf.push_back(char(v >> (8 * i)));
+}
+
+void append_u64(std::string& buf, uint64_t v)
+{
+    for (size_t i = 0; i < 8; ++i)
+        buf.push_back(char(v >> (8 * i)));
+}
+
+[[noreturn]] void throw_invalid(const std::string& msg)
+{
+    throw std::runtime_error("formula token container: " + msg);
+}
+
+/**
+ * Bounds-checked reader of little-endian values.
+ */
+class reader
+{
+    const char* m_p;
+    const char* m_end;
+
+public:
+    reader(const char* p, const char* end) : m_p(p), m_end(end) {}
+
+    const char* pos() const { return m_p; }
+
+    size_t remaining() const { return m_end - m_p; }
+
+    void require(size_t n) const
+    {
+        if (remaining() < n)
+            throw_invalid("unexpected end of data.  The file is truncated.");
+    }
+
+    const char* skip(size_t n)
+    {
+        require(n);
+        const char* p = m_p;
+        m_p += n;
+        return p;
+    }
+
+    uint64_t uint(size_t n)
+    {
+        const auto* p = reinterpret_cast<const uint8_t*>(skip(n));
+        uint64_t v = 0;
+        for (size_t i = 0; i < n; ++i)
+            v |= uint64_t(p[i]) << (8 * i);
+        return v;
+    }
+
+    uint32_t u32() { return uint(4); }
+
+    uint64_t u64() { return uint(8); }
+};
+
+/**
+ * Run a function on each of the blocks, spreading them evenly across up to
+ * the specified number of threads.
+ */
+template<typename FuncT>
+void for_each_block(std::vector<block>& blocks, size_t thread_count, FuncT func)
+{
+    size_t chunk_count = std::max<size_t>(1, std::min(thread_count, blocks.size()));
+    if (chunk_count == 1)
+    {
+        for (block& b : blocks)
+            func(b);
+        return;
+    }
+
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        size_t begin = blocks.size() * i / chunk_count;
+        size_t end = blocks.size() * (i + 1) / chunk_count;
+
+        futures.push_back(std::async(std::launch::async,
+            [&blocks, &func, begin, end]()
+            {
+                for (size_t j = begin; j < end; ++j)
+                    func(blocks[j]);
+            }
+        ));
+    }
+
+    for (auto& f : futures)
+        f.get();
+}
+
+} // anonymous namespace
+
+bool has_magic(const char* p, size_t n)
+{
+    return n >= sizeof(magic) && !std::memcmp(p, magic, sizeof(magic));
+}
+
+void write(std::ostream& os, uint64_t entry_count, const std::string& packed_state, size_t thread_count)
+{
+    std::vector<block> blocks;
+    for (size_t offset = 0; offset < packed_state.size(); offset += block_size)
+    {
+        uint32_t size = std::min(block_size, packed_state.size() - offset);
+        blocks.push_back({size, 0, 0, nullptr, offset});
+    }
+
+    std::vector<std::string> compressed(blocks.size());
+    std::vector<uint32_t> raw_crcs(blocks.size());
+
+    for_each_block(blocks, thread_count,
+        [&packed_state, &blocks, &compressed, &raw_crcs](block& b)
+        {
+            std::string& buf = compressed[&b - blocks.data()];
+            raw_crcs[&b - blocks.data()] = crc32_of(packed_state.data() + b.raw_offset, b.raw_size);
+
+            uLongf size = compressBound(b.raw_size);
+            buf.resize(size);
+
+            int ret = compress2(
+                reinterpret_cast<Bytef*>(&buf[0]), &size,
+                reinterpret_cast<const Bytef*>(packed_state.data() + b.raw_offset), b.raw_size,
+                Z_DEFAULT_COMPRESSION);
+
+            if (ret != Z_OK)
+                throw std::runtime_error("formula token container: failed to compress a block.");
+
+            buf.resize(size);
+            b.compressed_size = size;
+            b.crc = crc32_of(buf.data(), buf.size());
+        }
+    );
+
+    std::string header;
+    header.append(magic, sizeof(magic));
+    append_u32(header, version);
+    append_u32(header, token_encoding_version);
+    append_u64(header, entry_count);
+    append_u32(header, 1); // section count
+    append_u32(header, crc32_of(header.data(), header.size()));
+
+    std::string table;
+    for (const block& b : blocks)
+    {
+        append_u32(table, b.raw_size);
+        append_u32(table, b.compressed_size);
+        append_u32(table, b.crc);
+    }
+
+    append_u32(header, sec_packed_trie);
+    append_u32(header, blocks.size());
+    append_u64(header, packed_state.size());
+    append_u32(header, combine_crcs(blocks, raw_crcs));
+    append_u32(header, crc32_of(table.data(), table.size()));
+
+    os.write(header.data(), header.size());
+    os.write(table.data(), table.size());
+    for (const std::string& buf : compressed)
+        os.write(buf.data(), buf.size());
+}
+
+std::string read(const char* p, size_t n, uint64_t& entry_count, size_t thread_count)
+{
+    if (!has_magic(p, n))
+        throw_invalid("invalid magic.");
+
+    reader r(p + sizeof(magic), p + n);
+    r.require(header_size - sizeof(magic));
+
+    // The checksum covers all header fields before it.
+    reader cr(p + header_size - 4, p + header_size);
+    if (crc32_of(p, header_size - 4) != cr.u32())
+        throw_invalid("header checksum mismatch.  The file is damaged.");
+
+    uint32_t file_version = r.u32();
+    if (file_version != version)
+    {
+        std::ostringstream os;
+        os << "unsupported container version " << file_version << " (expected " << version << ").";
+        throw_invalid(os.str());
+    }
+
+    uint32_t encoding = r.u32();
+    if (encoding != token_encoding_version)
+    {
+        std::ostringstream os;
+        os << "token encoding version " << encoding << " does not match the supported version "
+           << token_encoding_version << ".";
+        throw_invalid(os.str());
+    }
+
+    entry_count = r.u64();
+    uint32_t section_count = r.u32();
+    r.u32(); // header checksum
+
+    std::string packed_state;
+    bool found = false;
+
+    for (uint32_t si = 0; si < section_count; ++si)
+    {
+        uint32_t type = r.u32();
+        uint32_t block_count = r.u32();
+        uint64_t raw_size = r.u64();
+        uint32_t raw_crc = r.u32();
+        uint32_t table_crc = r.u32();
+
+        if (uint64_t(block_count) * block_entry_size > r.remaining())
+            throw_invalid("unexpected end of data.  The file is truncated.");
+
+        const char* table = r.pos();
+        if (crc32_of(table, block_count * block_entry_size) != table_crc)
+            throw_invalid("block table checksum mismatch.  The file is damaged.");
+
+        std::vector<block> blocks(block_count);
+        uint64_t total_raw = 0;
+
+        for (block& b : blocks)
+        {
+            b.raw_size = r.u32();
+            b.compressed_size = r.u32();
+            b.crc = r.u32();
+            b.raw_offset = total_raw;
+            total_raw += b.raw_size;
+        }
+
+        if (total_raw != raw_size)
+            throw_invalid("inconsistent section size.");
+
+        for (block& b : blocks)
+            b.data = r.skip(b.compressed_size);
+
+        if (type != sec_packed_trie)
+            // Skip unknown section types for forward compatibility.
+            continue;
+
+        if (found)
+            throw_invalid("duplicate packed trie section.");
+
+        found = true;
+        packed_state.resize(raw_size);
+        std::vector<uint32_t> crcs(blocks.size());
+
+        // Each block gets decompressed into its own part of the output.
+        for_each_block(blocks, thread_count,
+            [&packed_state, &blocks, &crcs](const block& b)
+            {
+                if (crc32_of(b.data, b.compressed_size) != b.crc)
+                    throw_invalid("block checksum mismatch.  The file is damaged.");
+
+                uLongf size = b.raw_size;
+                int ret = uncompress(
+                    reinterpret_cast<Bytef*>(&packed_state[b.raw_offset]), &size,
+                    reinterpret_cast<const Bytef*>(b.data), b.compressed_size);
+
+                if (ret != Z_OK || size != b.raw_size)
+                    throw_invalid("failed to decompress a block.  The file is damaged.");
+
+                crcs[&b - blocks.data()] = crc32_of(packed_state.data() + b.raw_offset, b.raw_size);
+            }
+        );
+
+        if (combine_crcs(blocks, crcs) != raw_crc)
+            throw_invalid("section checksum mismatch.  The file is damaged.");
+    }
+
+    if (!found)
+        throw_invalid("packed trie section is missing.");
+
+    return packed_state;
+}
+
+} // namespace trie_container
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,121 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/**
+ * Container of the packed trie in formula-tokens.bin.  The content is split
+ * into sections, and each section into blocks that are compressed
+ * independently with zlib, so that they can be decompressed in parallel.
+ * Every part of the file is covered by a CRC-32 checksum, so that a
+ * truncated or damaged file is rejected before anything gets decoded.  All
+ * integers are unsigned and little-endian.
+ *
+ * The file starts with a header:
+ *
+ * - magic (8 bytes)
+ * - container version (4 bytes)
+ * - token encoding version (4 bytes)
+ * - entry count (8 bytes)
+ * - section count (4 bytes)
+ * - checksum of the preceding header bytes (4 bytes)
+ *
+ * followed by the sections, each consisting of:
+ *
+ * - section type (4 bytes)
+ * - block count (4 bytes)
+ * - uncompressed size (8 bytes)
+ * - checksum of the uncompressed content (4 bytes)
+ * - checksum of the block table (4 bytes)
+ * - block table: uncompressed size (4 bytes), compressed size (4 bytes)
+ *   and checksum of the compressed bytes (4 bytes) of each block
+ * - compressed blocks
+ */
+namespace trie_container {
+
+constexpr char magic[8] = { 'O', 'M', 'L', 'F', 'T', 'B', 'I', 'N' };
+constexpr uint32_t version = 1;
+
+/**
+ * Version of the token encoding used for the keys.  Increment this
+ * whenever the encoding of the formula tokens changes, so that files
+ * written with the old encoding get rejected.
+ */
+constexpr uint32_t token_encoding_version = 1;
+
+/** uncompressed size of each block. */
+constexpr size_t block_size = 1 << 20;
+
+enum section_type : uint32_t
+{
+    sec_packed_trie = 1, // state of mdds::packed_trie_map.
+};
+
+bool has_magic(const char* p, size_t n);
+
+/**
+ * Write the container with a packed trie state.
+ *
+ * @param os output stream.
+ * @param entry_count number of entries in the trie.
+ * @param packed_state state of the packed trie, as written by its
+ *                     save_state().
+ * @param thread_count number of threads to compress the blocks with.
+ */
+void write(std::ostream& os, uint64_t entry_count, const std::string& packed_state, size_t thread_count);
+
+/**
+ * Validate a container in memory, and extract the packed trie state.
+ *
+ * @param p container data.
+ * @param n size of the container data.
+ * @param entry_count set to the number of entries in the trie.
+ * @param thread_count number of threads to decompress the blocks with.
+ *
+ * @return state of the packed trie, to pass to its load_state().
+ *
+ * @throw std::runtime_error if the data is not a valid container of a
+ *        supported version.
+ */
+std::string read(const char* p, size_t n, uint64_t& entry_count, size_t thread_count);
+
+/**
+ * Load a packed trie from a container in memory.  Data without the
+ * container magic is loaded as the raw packed trie state, which is how
+ * formula-tokens.bin used to be written.
+ *
+ * @throw std::runtime_error if the container is not valid, or does not
+ *        match the trie.
+ */
+template<typename PackedT>
+void load(const char* p, size_t n, PackedT& packed, size_t thread_count)
+{
+    if (!has_magic(p, n))
+    {
+        std::istringstream is(std::string(p, n));
+        packed.load_state(is);
+        return;
+    }
+
+    uint64_t entry_count = 0;
+    std::istringstream is(read(p, n, entry_count, thread_count));
+    packed.load_state(is);
+
+    if (packed.size() != entry_count)
+        throw std::runtime_error("formula token container: entry count does not match the header.");
+}
+
+} // namespace trie_container
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
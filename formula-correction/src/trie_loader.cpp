@@ -7,16 +7,372 @@
 
 #include "trie_loader.hpp"
 #include "token_decoder.hpp"
+#include "async_queue.hpp"
+#include "trie_container.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <future>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <thread>
 
-using std::endl;
+namespace {
+
+/** Size of the blocks in which the dump output is written. */
+constexpr size_t dump_block_size = 1 << 20;
+
+/**
+ * Largest number of nodes in a part of the dump formatted in memory.  The
+ * formatted entries take some tens of bytes per node.
+ */
+constexpr size_t dump_unit_nodes = 1 << 16;
+
+void append_number(std::string& buf, uint32_t v)
+{
+    char digits[16];
+    char* end = std::to_chars(digits, digits + sizeof(digits), v).ptr;
+    buf.append(digits, end);
+}
+
+/**
+ * Formats one entry per line, with the number of occurrences as the first
+ * value.  The tokens are decoded in batches through the string tables, or
+ * remapped through the vocabulary if one is used.
+ */
+class entry_formatter
+{
+    trie_loader::mode_type m_mode;
+    const token_vocab* m_vocab;
+    std::vector<uint16_t> m_ids;
+
+public:
+    entry_formatter(trie_loader::mode_type mode, const token_vocab* vocab) : m_mode(mode), m_vocab(vocab) {}
+
+    void append(std::string& buf, const std::vector<uint16_t>& tokens, uint32_t count)
+    {
+        append_number(buf, count);
+        buf.push_back(' ');
+
+        switch (m_mode)
+        {
+            case trie_loader::NAME:
+            case trie_loader::SYMBOL:
+            {
+                auto kind = m_mode == trie_loader::NAME ? token_string_table::names : token_string_table::symbols;
+                m_ids.resize(tokens.size());
+                decode_token_ids(tokens.data(), tokens.size(), m_ids.data());
+                token_string_table::get(kind).append(buf, m_ids.data(), m_ids.size(), ' ');
+                break;
+            }
+            case trie_loader::VALUE:
+            {
+                // No decoding - print the token values, or their dense
+                // identifiers.
+                const uint16_t* values = tokens.data();
+                if (m_vocab)
+                {
+                    m_ids.resize(tokens.size());
+                    m_vocab->remap(tokens.data(), tokens.size(), m_ids.data());
+                    values = m_ids.data();
+                }
+
+                for (const uint16_t* end = values + tokens.size(); values != end; ++values)
+                {
+                    append_number(buf, *values);
+                    buf.push_back(' ');
+                }
+                break;
+            }
+            default:
+                ;
+        }
+
+        buf.push_back('\n');
+    }
+
+    void write(std::ostream& os, std::string& buf, const std::vector<uint16_t>& tokens, uint32_t count)
+    {
+        buf.clear();
+        append(buf, tokens, count);
+        os.write(buf.data(), buf.size());
+    }
+};
+
+bool contains_all(const std::vector<uint16_t>& key, const std::vector<uint16_t>& tokens)
+{
+    for (const uint16_t v : tokens)
+    {
+        if (std::find(key.begin(), key.end(), v) == key.end())
+            return false;
+    }
+
+    return true;
+}
+
+bool may_contain(const flat_trie::node_type& nd, size_t depth, const trie_loader::dump_filter& filter)
+{
+    return nd.subtree_max >= filter.min_count && (!filter.max_length || depth <= filter.max_length);
+}
+
+bool passes(const flat_trie::node_type& nd, const flat_trie::key_type& key, const trie_loader::dump_filter& filter)
+{
+    return nd.value && nd.value >= filter.min_count && contains_all(key, filter.required_tokens);
+}
+
+/**
+ * Visit the entries under a node that pass a filter, in ascending key
+ * order.  Sub-trees are skipped when they are too deep or when their
+ * largest count is below the minimum.
+ *
+ * @param key key of the starting node.  It is restored before returning.
+ */
+template<typename FuncT>
+void for_each_filtered(
+    const flat_trie& trie, const flat_trie::node_type& nd, flat_trie::key_type& key,
+    const trie_loader::dump_filter& filter, FuncT func)
+{
+    using node_type = flat_trie::node_type;
+
+    auto visit = [&](const node_type& nd)
+    {
+        if (passes(nd, key, filter))
+            func(static_cast<const flat_trie::key_type&>(key), nd.value);
+    };
+
+    if (!may_contain(nd, key.size(), filter))
+        return;
+
+    visit(nd);
+
+    std::vector<std::pair<const node_type*, const node_type*>> stack;
+    stack.emplace_back(trie.children_begin(nd), trie.children_end(nd));
+
+    while (!stack.empty())
+    {
+        auto& top = stack.back();
+        if (top.first == top.second)
+        {
+            stack.pop_back();
+            if (!stack.empty())
+                key.pop_back();
+            continue;
+        }
+
+        const node_type& child = *top.first++;
+        if (!may_contain(child, key.size() + 1, filter))
+            continue;
+
+        key.push_back(child.label);
+        visit(child);
+        stack.emplace_back(trie.children_begin(child), trie.children_end(child));
+    }
+}
+
+/**
+ * Part of the dump output: the sub-trees of a range of sibling nodes, or
+ * only the entry of a single node whose sub-tree is split further.
+ */
+struct dump_unit
+{
+    flat_trie::key_type key; // key of the parent of the nodes.
+    const flat_trie::node_type* first;
+    const flat_trie::node_type* last;
+    bool entry_only;
+};
+
+/**
+ * Nodes deeper than this are not split any further, which also bounds the
+ * recursion on a corrupt file.
+ */
+constexpr size_t max_split_depth = 64;
+
+/**
+ * Split the sub-trees of a range of sibling nodes into units of about the
+ * specified number of nodes, in key order.  A sub-tree that is too large is
+ * replaced by the entry of its root followed by the units of its children,
+ * and small neighbouring sub-trees are grouped.
+ *
+ * The sizes are taken from the layout written by flat_trie_writer, where
+ * the descendants of each node are stored contiguously right after those
+ * of its preceding sibling.  They only affect how the work is split.
+ *
+ * @param start index of the first descendant of the first node.
+ * @param key key of the parent of the nodes.  It is restored before
+ *            returning.
+ */
+void split_range(
+    const flat_trie& trie, const flat_trie::node_type* first, const flat_trie::node_type* last,
+    size_t start, flat_trie::key_type& key, const trie_loader::dump_filter& filter, size_t unit_nodes,
+    std::vector<dump_unit>& units)
+{
+    const flat_trie::node_type* group = first;
+    size_t group_nodes = 0;
+
+    auto flush = [&](const flat_trie::node_type* end)
+    {
+        if (group != end)
+            units.push_back({key, group, end, false});
+
+        group = end;
+        group_nodes = 0;
+    };
+
+    for (const flat_trie::node_type* nd = first; nd != last; ++nd)
+    {
+        size_t sub_start = start;
+        size_t end = size_t(nd->first_child) + nd->child_count;
+        start = std::max(start, end);
+        size_t nodes = start - sub_start + 1;
+
+        bool split = nodes > unit_nodes && nd->child_count && key.size() < max_split_depth &&
+            may_contain(*nd, key.size() + 1, filter);
+
+        if (!split)
+        {
+            if (group_nodes && group_nodes + nodes > unit_nodes)
+                flush(nd);
+
+            group_nodes += nodes;
+            continue;
+        }
+
+        flush(nd);
+
+        key.push_back(nd->label);
+        if (passes(*nd, key, filter))
+        {
+            key.pop_back();
+            units.push_back({key, nd, nd + 1, true});
+            key.push_back(nd->label);
+        }
+
+        split_range(
+            trie, trie.children_begin(*nd), trie.children_end(*nd), sub_start, key, filter, unit_nodes, units);
+        key.pop_back();
+
+        group = nd + 1;
+    }
+
+    flush(last);
+}
+
+std::vector<dump_unit> split_dump(
+    const flat_trie& trie, const trie_loader::dump_filter& filter, size_t unit_nodes)
+{
+    std::vector<dump_unit> units;
+    flat_trie::key_type key;
+    const flat_trie::node_type& root = trie.root();
+    split_range(trie, trie.children_begin(root), trie.children_end(root), 0, key, filter, unit_nodes, units);
+    return units;
+}
+
+template<typename FuncT>
+void for_each_in_unit(
+    const flat_trie& trie, const dump_unit& unit, const trie_loader::dump_filter& filter, FuncT func)
+{
+    flat_trie::key_type key = unit.key;
+
+    for (const flat_trie::node_type* nd = unit.first; nd != unit.last; ++nd)
+    {
+        key.push_back(nd->label);
+
+        if (!unit.entry_only)
+            for_each_filtered(trie, *nd, key, filter, func);
+        else if (passes(*nd, key, filter))
+            func(static_cast<const flat_trie::key_type&>(key), nd->value);
+
+        key.pop_back();
+    }
+}
+
+/**
+ * Format the entries of a range of units, and write them to a stream in
+ * blocks.
+ */
+void dump_units(
+    std::ostream& os, const flat_trie& trie, const dump_unit* first, const dump_unit* last,
+    trie_loader::mode_type mode, const trie_loader::dump_filter& filter, const token_vocab* vocab)
+{
+    entry_formatter formatter(mode, vocab);
+    std::string buf;
+    buf.reserve(dump_block_size * 2);
+
+    for (; first != last; ++first)
+    {
+        for_each_in_unit(trie, *first, filter,
+            [&](const flat_trie::key_type& k, uint32_t count)
+            {
+                formatter.append(buf, k, count);
+                if (buf.size() >= dump_block_size)
+                {
+                    os.write(buf.data(), buf.size());
+                    buf.clear();
+                }
+            }
+        );
+    }
+
+    os.write(buf.data(), buf.size());
+}
+
+/**
+ * Format the entries of one unit in memory.
+ */
+std::string format_unit(
+    const flat_trie& trie, const dump_unit* unit, trie_loader::mode_type mode,
+    const trie_loader::dump_filter& filter, const token_vocab* vocab)
+{
+    entry_formatter formatter(mode, vocab);
+    std::string buf;
+
+    for_each_in_unit(trie, *unit, filter,
+        [&](const flat_trie::key_type& k, uint32_t count) { formatter.append(buf, k, count); });
+
+    return buf;
+}
+
+} // anonymous namespace
 
 trie_loader::trie_loader() {}
 
+void trie_loader::load_packed(const char* p, size_t n)
+{
+    map_type packed;
+    trie_container::load(p, n, packed, std::max(1u, std::thread::hardware_concurrency()));
+
+    std::ostringstream os;
+    flat_trie_writer writer(os);
+    for (const auto& entry : packed)
+        writer.append(entry.first.data(), entry.first.size(), entry.second);
+    writer.finish();
+
+    m_mapped.reset();
+    m_buffer = os.str();
+    m_trie = flat_trie(m_buffer.data(), m_buffer.size());
+}
+
 void trie_loader::load(std::istream& is)
 {
-    m_trie.load_state(is);
+    std::string content((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+    load_packed(content.data(), content.size());
+}
+
+void trie_loader::load(const std::string& filepath, int flags)
+{
+    auto mapped = std::make_unique<mapped_file>(filepath, flags);
+
+    if (!flat_trie_format::has_magic(mapped->data(), mapped->size()))
+    {
+        load_packed(mapped->data(), mapped->size());
+        return;
+    }
+
+    m_trie = flat_trie(mapped->data(), mapped->size());
+    m_mapped = std::move(mapped);
+    m_buffer.clear();
 }
 
 size_t trie_loader::size() const
@@ -24,58 +380,147 @@ size_t trie_loader::size() const
     return m_trie.size();
 }
 
+const flat_trie& trie_loader::get() const
+{
+    return m_trie;
+}
+
+void trie_loader::set_vocab(const token_vocab* vocab)
+{
+    m_vocab = vocab;
+}
+
+std::vector<flat_trie::entry> trie_loader::top_k(const std::vector<uint16_t>& prefix, size_t k) const
+{
+    return m_trie.top_k(prefix.data(), prefix.size(), k);
+}
+
+std::vector<flat_trie::match> trie_loader::find_nearest(
+    const std::vector<uint16_t>& tokens, size_t max_distance, size_t max_results) const
+{
+    return m_trie.find_nearest(tokens.data(), tokens.size(), max_distance, max_results);
+}
+
 void trie_loader::dump(std::ostream& os, mode_type mode) const
 {
-    switch (mode)
+    dump(os, mode, dump_filter(), 1);
+}
+
+void trie_loader::dump(std::ostream& os, mode_type mode, const dump_filter& filter, size_t thread_count) const
+{
+    if (!m_trie.size())
+        return;
+
+    if (thread_count <= 1)
     {
-        case NAME:
-        {
-            for (const auto& entry : m_trie)
-            {
-                // number of occurrences as the first value in each line.
-                os << entry.second << ' ';
+        const flat_trie::node_type& root = m_trie.root();
+        dump_unit all{flat_trie::key_type(), m_trie.children_begin(root), m_trie.children_end(root), false};
+        dump_units(os, m_trie, &all, &all + 1, mode, filter, m_vocab);
+        return;
+    }
 
-                const std::vector<uint16_t>& tokens = entry.first;
-                for (const std::string& s : decode_tokens_to_names(tokens))
-                    os << s << ' ';
+    // Format the units in parallel, and write them out in order.  At most
+    // thread_count of them are held in memory at a time, and they are
+    // bounded in size, however skewed the key space is.
+    size_t unit_nodes = std::min(dump_unit_nodes, std::max<size_t>(1, m_trie.node_count() / (thread_count * 16)));
+    std::vector<dump_unit> units = split_dump(m_trie, filter, unit_nodes);
 
-                os << endl;
-            }
+    async_queue<std::string> queue(thread_count);
+    size_t pending = 0;
 
-            break;
-        }
-        case SYMBOL:
+    for (const dump_unit& unit : units)
+    {
+        if (pending == thread_count)
         {
-            for (const auto& entry : m_trie)
-            {
-                // number of occurrences as the first value in each line.
-                os << entry.second << ' ';
+            std::string buf = queue.get_one();
+            os.write(buf.data(), buf.size());
+            --pending;
+        }
 
-                const std::vector<uint16_t>& tokens = entry.first;
-                for (const std::string& s : decode_tokens_to_symbols(tokens))
-                    os << s << ' ';
+        queue.push(format_unit, std::cref(m_trie), &unit, mode, std::cref(filter), m_vocab);
+        ++pending;
+    }
 
-                os << endl;
-            }
+    for (; pending; --pending)
+    {
+        std::string buf = queue.get_one();
+        os.write(buf.data(), buf.size());
+    }
+}
 
-            break;
-        }
-        case VALUE:
-        {
-            for (const auto& entry : m_trie)
-            {
-                // number of occurrences as the first value in each line.
-                os << entry.second << ' ';
+void trie_loader::dump_shards(
+    const std::vector<std::ostream*>& shards, mode_type mode, const dump_filter& filter, size_t thread_count) const
+{
+    if (shards.empty() || !m_trie.size())
+        return;
 
-                // No decoding - print the token values.
-                for (const uint16_t v : entry.first)
-                    os << v << ' ';
+    // Split finely enough for the shards to come out balanced even when a
+    // few first tokens hold most of the entries.
+    size_t unit_nodes = std::max<size_t>(1, m_trie.node_count() / (shards.size() * 16));
+    std::vector<dump_unit> units = split_dump(m_trie, filter, unit_nodes);
 
-                os << endl;
-            }
+    // Count the entries in each unit to balance the shards.
+    std::vector<size_t> counts;
+    size_t total = 0;
 
-            break;
-        }
+    for (const dump_unit& unit : units)
+    {
+        size_t n = 0;
+        for_each_in_unit(m_trie, unit, filter, [&n](const flat_trie::key_type&, uint32_t) { ++n; });
+        counts.push_back(n);
+        total += n;
+    }
+
+    // Each shard gets a contiguous range of the units.  A range ends once
+    // its cumulative share of the entries is reached.
+    const dump_unit* first = units.data();
+    const dump_unit* last = first + units.size();
+    std::vector<const dump_unit*> bounds(1, first);
+    size_t cumulative = 0;
+
+    for (size_t i = 0; i < counts.size() && bounds.size() < shards.size(); ++i)
+    {
+        cumulative += counts[i];
+        if (cumulative * shards.size() >= total * bounds.size())
+            bounds.push_back(first + i + 1);
+    }
+
+    while (bounds.size() <= shards.size())
+        bounds.push_back(last);
+
+    std::atomic<size_t> next{0};
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < shards.size(); i = next++)
+            dump_units(*shards[i], m_trie, bounds[i], bounds[i+1], mode, filter, m_vocab);
+    };
+
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < std::min(thread_count, shards.size()); ++i)
+        futures.push_back(std::async(std::launch::async, worker));
+
+    for (auto& f : futures)
+        f.get();
+}
+
+void trie_loader::dump_top_k(std::ostream& os, const std::vector<uint16_t>& prefix, size_t k, mode_type mode) const
+{
+    entry_formatter formatter(mode, m_vocab);
+    std::string buf;
+    for (const flat_trie::entry& e : top_k(prefix, k))
+        formatter.write(os, buf, e.key, e.value);
+}
+
+void trie_loader::dump_nearest(
+    std::ostream& os, const std::vector<uint16_t>& tokens, size_t max_distance,
+    size_t max_results, mode_type mode) const
+{
+    entry_formatter formatter(mode, m_vocab);
+    std::string buf;
+    for (const flat_trie::match& m : find_nearest(tokens, max_distance, max_results))
+    {
+        os << m.distance << ' ';
+        formatter.write(os, buf, m.key, m.value);
     }
 }
 
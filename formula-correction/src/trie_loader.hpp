@@ -8,27 +8,127 @@
 #pragma once
 
 #include "types.hpp"
+#include "flat_trie.hpp"
+#include "mapped_file.hpp"
+#include "token_vocab.hpp"
 
 #include <mdds/trie_map.hpp>
+#include <memory>
+#include <string>
 
 class trie_loader
 {
     using key_trait = mdds::trie::std_container_trait<std::vector<uint16_t>>;
     using map_type = mdds::packed_trie_map<key_trait, int>;
 
-    map_type m_trie;
+    std::unique_ptr<mapped_file> m_mapped;
+    std::string m_buffer; // flat trie converted from the packed format.
+    flat_trie m_trie;
+    const token_vocab* m_vocab = nullptr;
+
+    void load_packed(const char* p, size_t n);
 
 public:
 
     enum mode_type { UNKNOWN = -1, NAME = 0, SYMBOL = 1, VALUE = 2 };
 
+    /**
+     * Criteria for the entries to dump.  An entry is dumped only if it
+     * meets all of them.
+     */
+    struct dump_filter
+    {
+        uint32_t min_count = 0;
+        size_t max_length = 0; // number of tokens, or 0 for no limit.
+        std::vector<uint16_t> required_tokens; // tokens that must all occur.
+    };
+
     trie_loader();
 
+    /**
+     * Load a trie written in the packed format.  The trie gets converted to
+     * the flat layout on the heap.
+     *
+     * @throw std::runtime_error if the data is truncated, damaged, or of an
+     *        unsupported version.
+     */
     void load(std::istream& is);
 
+    /**
+     * Load a trie from a file.  A file in the flat layout gets memory-mapped
+     * and queried in place, whereas a file in the packed format gets decoded
+     * from the mapping and converted as in load(std::istream&).
+     *
+     * @param flags mapped_file::flags_type values to use when mapping the
+     *              file.
+     */
+    void load(const std::string& filepath, int flags = mapped_file::map_default);
+
     size_t size() const;
 
+    const flat_trie& get() const;
+
+    /**
+     * Have the dumps in the 'value' mode print the dense identifiers of a
+     * vocabulary instead of the token values.  The vocabulary must outlive
+     * the loader, or be unset by passing nullptr.
+     */
+    void set_vocab(const token_vocab* vocab);
+
+    /**
+     * Find the k most frequent formula expressions that start with the
+     * specified tokens.
+     *
+     * @return up to k entries in descending order of their counts.
+     */
+    std::vector<flat_trie::entry> top_k(const std::vector<uint16_t>& prefix, size_t k) const;
+
+    /**
+     * Find the formula expressions within the specified token-level edit
+     * distance of a token sequence.
+     *
+     * @return up to max_results entries sorted by ascending distance, then
+     *         by descending count.
+     */
+    std::vector<flat_trie::match> find_nearest(
+        const std::vector<uint16_t>& tokens, size_t max_distance, size_t max_results) const;
+
     void dump(std::ostream& os, mode_type mode) const;
+
+    /**
+     * Dump the entries that pass a filter in ascending key order.  The key
+     * space is split into parts of a bounded number of nodes, descending
+     * into the sub-trees that are too large, and the parts are formatted on
+     * up to the specified number of threads, each holding its part in
+     * memory until it is written out in order.  With one thread, the output
+     * is streamed in blocks instead.
+     */
+    void dump(std::ostream& os, mode_type mode, const dump_filter& filter, size_t thread_count) const;
+
+    /**
+     * Dump the entries that pass a filter into several streams.  Each shard
+     * gets a contiguous range of the key space, split as finely as needed
+     * to balance the shards by the number of entries, so that the shards
+     * concatenated in order contain the same output as dump().  The shards
+     * are written in parallel, in blocks.
+     */
+    void dump_shards(
+        const std::vector<std::ostream*>& shards, mode_type mode, const dump_filter& filter,
+        size_t thread_count) const;
+
+    /**
+     * Dump the k most frequent formula expressions that start with the
+     * specified tokens, in descending order of their counts.
+     */
+    void dump_top_k(std::ostream& os, const std::vector<uint16_t>& prefix, size_t k, mode_type mode) const;
+
+    /**
+     * Dump the formula expressions nearest to a token sequence, each line
+     * starting with its edit distance.
+     */
+    void dump_nearest(
+        std::ostream& os, const std::vector<uint16_t>& tokens, size_t max_distance,
+        size_t max_results, mode_type mode) const;
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,49 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "trie_reducer.hpp"
+
+trie_reducer::trie_reducer() {}
+
+void trie_reducer::reduce(trie_builder trie)
+{
+    while (true)
+    {
+        trie_builder other;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (!m_has_pending)
+            {
+                // Leave it for the next thread to pick up.
+                m_pending.swap(trie);
+                m_has_pending = true;
+                return;
+            }
+
+            other.swap(m_pending);
+            m_has_pending = false;
+        }
+
+        // Merge the smaller trie into the larger one.
+        if (trie.size() < other.size())
+            trie.swap(other);
+
+        trie.merge(other);
+    }
+}
+
+trie_builder trie_reducer::release()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    trie_builder trie;
+    trie.swap(m_pending);
+    m_has_pending = false;
+    return trie;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
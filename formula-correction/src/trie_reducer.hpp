@@ -0,0 +1,47 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include "trie_builder.hpp"
+
+#include <mutex>
+
+/**
+ * Merges the tries produced by multiple worker threads pairwise.  A worker
+ * that is done with its own work either leaves its trie for another worker
+ * to pick up, or takes the one left by another worker and merges the two
+ * before trying again.  The merges thus run in parallel on the worker
+ * threads as soon as they finish, rather than one after another on the
+ * main thread.
+ */
+class trie_reducer
+{
+    std::mutex m_mtx;
+    trie_builder m_pending;
+    bool m_has_pending = false;
+
+public:
+    trie_reducer();
+
+    trie_reducer(const trie_reducer&) = delete;
+    trie_reducer& operator= (const trie_reducer&) = delete;
+
+    /**
+     * Hand over a trie for merging.  This call may block for as long as it
+     * takes to merge it with the tries handed over by other threads.
+     */
+    void reduce(trie_builder trie);
+
+    /**
+     * Take the fully merged trie.  Call this only after all threads have
+     * returned from reduce().
+     */
+    trie_builder release();
+};
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
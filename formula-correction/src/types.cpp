@@ -6,161 +6,198 @@
  */
 
 #include "types.hpp"
+#include "perfect_hash.hpp"
 
-#include <mdds/sorted_string_map.hpp>
-#include <orcus/global.hpp>
+#include <ixion/formula_function_opcode.hpp>
 
 namespace op_type {
 
-typedef mdds::sorted_string_map<ixion::fopcode_t> map_type;
+using map_type = perfect_hash::static_map<ixion::fopcode_t, 24>;
+
+constexpr map_type map({
+    { "close",            ixion::fop_close            },
+    { "concat",           ixion::fop_concat           },
+    { "divide",           ixion::fop_divide           },
+    { "equal",            ixion::fop_equal            },
+    { "error",            ixion::fop_error            },
+    { "exponent",         ixion::fop_exponent         },
+    { "function",         ixion::fop_function         },
+    { "greater",          ixion::fop_greater          },
+    { "greater-equal",    ixion::fop_greater_equal    },
+    { "less",             ixion::fop_less             },
+    { "less-equal",       ixion::fop_less_equal       },
+    { "minus",            ixion::fop_minus            },
+    { "multiply",         ixion::fop_multiply         },
+    { "named-expression", ixion::fop_named_expression },
+    { "not-equal",        ixion::fop_not_equal        },
+    { "open",             ixion::fop_open             },
+    { "plus",             ixion::fop_plus             },
+    { "range-ref",        ixion::fop_range_ref        },
+    { "sep",              ixion::fop_sep              },
+    { "single-ref",       ixion::fop_single_ref       },
+    { "string",           ixion::fop_string           },
+    { "table-ref",        ixion::fop_table_ref        },
+    { "unknown",          ixion::fop_unknown          },
+    { "value",            ixion::fop_value            },
+}, ixion::fop_unknown);
 
-// Keys must be sorted.
-const std::vector<map_type::entry> entries =
-{
-    { ORCUS_ASCII("close"),            ixion::fop_close            },
-    { ORCUS_ASCII("concat"),           ixion::fop_concat           },
-    { ORCUS_ASCII("divide"),           ixion::fop_divide           },
-    { ORCUS_ASCII("equal"),            ixion::fop_equal            },
-    { ORCUS_ASCII("error"),            ixion::fop_error            },
-    { ORCUS_ASCII("exponent"),         ixion::fop_exponent         },
-    { ORCUS_ASCII("function"),         ixion::fop_function         },
-    { ORCUS_ASCII("greater"),          ixion::fop_greater          },
-    { ORCUS_ASCII("greater-equal"),    ixion::fop_greater_equal    },
-    { ORCUS_ASCII("less"),             ixion::fop_less             },
-    { ORCUS_ASCII("less-equal"),       ixion::fop_less_equal       },
-    { ORCUS_ASCII("minus"),            ixion::fop_minus            },
-    { ORCUS_ASCII("multiply"),         ixion::fop_multiply         },
-    { ORCUS_ASCII("named-expression"), ixion::fop_named_expression },
-    { ORCUS_ASCII("not-equal"),        ixion::fop_not_equal        },
-    { ORCUS_ASCII("open"),             ixion::fop_open             },
-    { ORCUS_ASCII("plus"),             ixion::fop_plus             },
-    { ORCUS_ASCII("range-ref"),        ixion::fop_range_ref        },
-    { ORCUS_ASCII("sep"),              ixion::fop_sep              },
-    { ORCUS_ASCII("single-ref"),       ixion::fop_single_ref       },
-    { ORCUS_ASCII("string"),           ixion::fop_string           },
-    { ORCUS_ASCII("table-ref"),        ixion::fop_table_ref        },
-    { ORCUS_ASCII("unknown"),          ixion::fop_unknown          },
-    { ORCUS_ASCII("value"),            ixion::fop_value            },
+// value-to-string map
+constexpr std::string_view names[] = {
+    "unknown",
+    "single-ref",
+    "range-ref",
+    "table-ref",
+    "named-expression",
+    "string",
+    "value",
+    "function",
+    "plus",
+    "minus",
+    "divide",
+    "multiply",
+    "exponent",
+    "concat",
+    "equal",
+    "not-equal",
+    "less",
+    "greater",
+    "less-equal",
+    "greater-equal",
+    "open",
+    "close",
+    "sep",
+    "error",
 };
 
-// value-to-string map
-const std::vector<size_t> v2s_map = {
-    22, // unknown
-    19, // single-ref
-    17, // range-ref
-    21, // table-ref
-    13, // named-expression
-    20, // string
-    23, // value
-     6, // function
-    16, // plus
-    11, // minus
-     2, // divide
-    12, // multiply
-     5, // exponent
-     1, // concat
-     3, // equal
-    14, // not-equal
-     9, // less
-     7, // greater
-    10, // less-equal
-     8, // greater-equal
-    15, // open
-     0, // close
-    18, // sep
-     4, // error
+constexpr std::string_view symbols[] = {
+    "???", // fop_unknown = 0,
+    "ref", // fop_single_ref,
+    "ref:ref", // fop_range_ref,
+    "ref[]", // fop_table_ref,
+    "name", // fop_named_expression,
+    "\"str\"", // fop_string,
+    "1", // fop_value,
+    "func", // fop_function,
+    "+", // fop_plus,
+    "-", // fop_minus,
+    "/", // fop_divide,
+    "*", // fop_multiply,
+    "^", // fop_exponent,
+    "&", // fop_concat,
+    "=", // fop_equal,
+    "<>", // fop_not_equal,
+    "<", // fop_less,
+    ">", // fop_greater,
+    "<=", // fop_less_equal,
+    ">=", // fop_greater_equal,
+    "(", // fop_open,
+    ")", // fop_close,
+    ",", // fop_sep,
+    "error", // fop_error,
 };
 
-const map_type& get()
+// Every name must map back to its own value.
+constexpr bool check_names()
 {
-    static map_type mt(entries.data(), entries.size(), ixion::fop_unknown);
-    return mt;
-}
+    for (size_t i = 0; i < std::size(names); ++i)
+    {
+        if (map.find(names[i]) != static_cast<ixion::fopcode_t>(i))
+            return false;
+    }
 
-orcus::pstring str(ixion::fopcode_t v)
-{
-    size_t v2 = static_cast<size_t>(v);
-    if (v2 >= v2s_map.size())
-        throw std::logic_error("op type value too large!");
-
-    size_t pos = v2s_map.at(v2);
-    const map_type::entry& e = entries.at(pos);
-    return orcus::pstring(e.key, e.keylen);
+    return true;
 }
 
+static_assert(check_names(), "op names are out of sync.");
+
 } // namespace op_type
 
 namespace token_type {
 
-typedef mdds::sorted_string_map<formula_token_t> map_type;
+constexpr perfect_hash::static_map<formula_token_t, 7> map({
+    { "error",     t_error     },
+    { "function",  t_function  },
+    { "name",      t_name      },
+    { "operator",  t_operator  },
+    { "reference", t_reference },
+    { "unknown",   t_unknown   },
+    { "value",     t_value     },
+}, t_unknown);
+
+} // namespace token_type
+
+namespace function_type {
+
+using map_type = perfect_hash::map<ixion::formula_function_t>;
 
-// Keys must be sorted.
-const std::vector<map_type::entry> entries =
+/**
+ * Build the map from the function names known to ixion.  Only the values
+ * that fit in the 9 bits of the token encoding are considered.
+ */
+map_type build()
 {
-    { ORCUS_ASCII("error"),     t_error     },
-    { ORCUS_ASCII("function"),  t_function  },
-    { ORCUS_ASCII("name"),      t_name      },
-    { ORCUS_ASCII("operator"),  t_operator  },
-    { ORCUS_ASCII("reference"), t_reference },
-    { ORCUS_ASCII("unknown"),   t_unknown   },
-    { ORCUS_ASCII("value"),     t_value     },
-};
+    const std::string unknown(ixion::get_formula_function_name(ixion::formula_function_t::func_unknown));
+
+    std::vector<std::string> names;
+    std::vector<perfect_hash::entry<ixion::formula_function_t>> entries;
+    names.reserve(511);
+
+    for (uint16_t v = 1; v <= 511; ++v)
+    {
+        auto fft = static_cast<ixion::formula_function_t>(v);
+        std::string name(ixion::get_formula_function_name(fft));
+        if (name.empty() || name == unknown)
+            continue;
+
+        names.push_back(std::move(name));
+        entries.push_back({names.back(), fft});
+    }
+
+    return map_type(entries, ixion::formula_function_t::func_unknown);
+}
 
 const map_type& get()
 {
-    static map_type mt(entries.data(), entries.size(), t_unknown);
+    static const map_type mt = build();
     return mt;
 }
 
-} // namespace token_type
+} // namespace function_type
 
 ixion::fopcode_t to_formula_op(const char* p, size_t n)
 {
-    return op_type::get().find(p, n);
+    return op_type::map.find(std::string_view(p, n));
+}
+
+ixion::formula_function_t to_formula_function(const char* p, size_t n)
+{
+    auto fft = function_type::get().find(std::string_view(p, n));
+    if (fft != ixion::formula_function_t::func_unknown)
+        return fft;
+
+    // Fall back on ixion for any name not in the canonical set.
+    return ixion::get_formula_function_opcode(p, n);
 }
 
 orcus::pstring to_string(ixion::fopcode_t v)
 {
-    return op_type::str(v);
+    size_t v2 = static_cast<size_t>(v);
+    if (v2 >= std::size(op_type::names))
+        throw std::logic_error("op type value too large!");
+
+    std::string_view s = op_type::names[v2];
+    return orcus::pstring(s.data(), s.size());
 }
 
 orcus::pstring to_symbol(ixion::fopcode_t v)
 {
-    const char* symbols[] = {
-        "???", // fop_unknown = 0,
-        "ref", // fop_single_ref,
-        "ref:ref", // fop_range_ref,
-        "ref[]", // fop_table_ref,
-        "name", // fop_named_expression,
-        "\"str\"", // fop_string,
-        "1", // fop_value,
-        "func", // fop_function,
-        "+", // fop_plus,
-        "-", // fop_minus,
-        "/", // fop_divide,
-        "*", // fop_multiply,
-        "^", // fop_exponent,
-        "&", // fop_concat,
-        "=", // fop_equal,
-        "<>", // fop_not_equal,
-        "<", // fop_less,
-        ">", // fop_greater,
-        "<=", // fop_less_equal,
-        ">=", // fop_greater_equal,
-        "(", // fop_open,
-        ")", // fop_close,
-        ",", // fop_sep,
-        "error", // fop_error,
-    };
-
-    const char* p = symbols[v];
-    size_t n = strlen(p);
-    return orcus::pstring(p, n);
+    std::string_view s = op_type::symbols[v];
+    return orcus::pstring(s.data(), s.size());
 }
 
 formula_token_t to_formula_token(const char* p, size_t n)
 {
-    return token_type::get().find(p, n);
+    return token_type::map.find(std::string_view(p, n));
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
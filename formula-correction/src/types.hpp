@@ -10,6 +10,7 @@
 #include <cstdint>
 #include <orcus/pstring.hpp>
 #include <ixion/formula_opcode.hpp>
+#include <ixion/formula_function_opcode.hpp>
 
 enum formula_token_t : uint8_t
 {
@@ -24,6 +25,12 @@ enum formula_token_t : uint8_t
 
 ixion::fopcode_t  to_formula_op(const char* p, size_t n);
 
+/**
+ * Same as ixion::get_formula_function_opcode(), but through a perfect hash
+ * of the function names built on first use.
+ */
+ixion::formula_function_t to_formula_function(const char* p, size_t n);
+
 orcus::pstring to_string(ixion::fopcode_t v);
 
 orcus::pstring to_symbol(ixion::fopcode_t v);